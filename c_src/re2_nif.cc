@@ -5,10 +5,29 @@
 #include <erl_nif.h>
 
 #include <re2/re2.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <map>
+#include <string>
+#include <thread>
 #include <vector>
 #include <memory>
 
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// SSE2 is part of every x86-64 target
+#if defined(__SSE2__) || defined(_M_X64)
+#define RE2_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
 #ifdef DEBUG
 #include <iostream>
 #define DBG(M)                                                                \
@@ -25,6 +44,33 @@ namespace {
 struct compileoptions
 {
     re2::RE2::Options re2opts;
+    bool lazy;
+    unsigned replicas;
+    bool warmup;
+    ERL_NIF_TERM samples;  // {warmup, Samples} list, if warmup
+    int64_t auto_max_mem;  // {auto_max_mem, Ceiling}, 0 if not given
+
+    compileoptions()
+    : lazy(false)
+    , replicas(1)
+    , warmup(false)
+    , auto_max_mem(0)
+    {
+        re2opts.set_log_errors(false);
+    }
+};
+
+//
+// Compile options that match/3 and match_file/3 also take. A call that
+// adds any of them to those of a compiled regex uses a variant of it, see
+// re2_handle::variants.
+//
+enum variant_flag
+{
+    VF_CASELESS      = 1,
+    VF_LATIN1        = 2,
+    VF_NEVER_CAPTURE = 4,
+    VF_ALL           = 7
 };
 
 struct matchoptions
@@ -35,24 +81,34 @@ struct matchoptions
         VS_ALL_BUT_FIRST,
         VS_FIRST,
         VS_NONE,
+        VS_ALL_NAMES,
         VS_VLIST
     };
     enum capture_type
     {
         CT_INDEX,
         CT_LIST,
-        CT_BINARY
+        CT_BINARY,
+        CT_MAP,
+        CT_CHAR_INDEX
     };
 
-    bool caseless;
-    int offset;
+    // variant_flag bits
+    unsigned variant;
+    // The subject is matched in the window [offset, limit), group offsets
+    // are still relative to the start of the subject.
+    size_t offset;
+    size_t limit;
+    re2::RE2::Anchor anchor;
     value_spec vs;
     capture_type ct;
     ERL_NIF_TERM vlist;
 
     matchoptions(ErlNifEnv* env)
-    : caseless(false)
+    : variant(0)
     , offset(0)
+    , limit(SIZE_MAX)
+    , anchor(re2::RE2::UNANCHORED)
     , vs(VS_ALL)
     , ct(CT_BINARY)
     {
@@ -68,6 +124,21 @@ struct replaceoptions
     {}
 };
 
+struct matchfileoptions
+{
+    matchoptions mopts;
+    bool global;
+    bool sequential;
+
+    matchfileoptions(ErlNifEnv* env)
+    : mopts(env)
+    , global(false)
+    , sequential(false)
+    {
+        mopts.ct = matchoptions::CT_INDEX;
+    }
+};
+
 // Cleanup function for C++ object created with enif allocator via C++
 // placement syntax which necessitates explicit invocation of the object's
 // destructor. This is used in the NIF resource cleanup callback and in a
@@ -89,12 +160,197 @@ struct EnifDeleter
     void operator()(T* ptr) { cleanup_obj_ptr(ptr); }
 };
 using Re2UniquePtr = std::unique_ptr<re2::RE2, EnifDeleter<re2::RE2>>;
+
+// Named capturing groups of a regex sorted by name, as needed for
+// {capture, all_names, _}. Building this walks NamedCapturingGroups() once,
+// so it's cached per compiled regex instead of being redone per match.
+struct re2_names
+{
+    std::vector<std::string> names;
+    std::vector<int> index;
+
+    re2_names() {}
+
+    explicit re2_names(const re2::RE2& re)
+    {
+        const auto& nmap = re.NamedCapturingGroups();
+        names.reserve(nmap.size());
+        index.reserve(nmap.size());
+        for (const auto& it : nmap) {
+            names.push_back(it.first);
+            index.push_back(it.second);
+        }
+    }
+};
+
+// A pattern without any metacharacters. It's searched for directly instead
+// of running RE2, see parse_literal(). text has escapes resolved.
+struct re2_literal
+{
+    bool valid;
+    std::string text;
+
+    re2_literal()
+    : valid(false)
+    {}
+};
+
+// re2:extract template with its group references resolved. A handle keeps
+// a short list of them, like it does for ranges, see handle_template().
+struct re2_template
+{
+    // A template is pieces[i].len bytes of literal followed by the text of
+    // group pieces[i].group, or by nothing if that is -1, for each piece.
+    struct piece
+    {
+        size_t len;
+        int group;
+    };
+
+    std::string text;
+    std::string literal;
+    std::vector<piece> pieces;
+    int nvec;  // groups to match, 1 + the highest one referred to
+    re2_template* next;
+    int depth;  // length of the list starting here
+
+    re2_template()
+    : nvec(1)
+    , next(nullptr)
+    , depth(1)
+    {}
+};
+
+// re2:possible_match_range result for one MaxLen. A handle keeps a short
+// list of them, which is only ever prepended to, see handle_range().
+struct re2_range
+{
+    int maxlen;
+    bool bounded;
+    std::string min;
+    std::string max;
+    re2_range* next;
+    int depth;  // length of the list starting here
+
+    re2_range()
+    : maxlen(0)
+    , bounded(false)
+    , next(nullptr)
+    , depth(1)
+    {}
+};
 }  // namespace
 
 struct re2_handle
 {
-    // RE2 objects are thread safe. no locking required.
-    re2::RE2* re;
+    // RE2 objects are thread safe, no locking required here. See replicas
+    // below for contention inside RE2 itself.
+    // re is only null for a {lazy, true} regex that has not been used yet.
+    // It's compiled on first use and published with a CAS, so concurrent
+    // first users never block each other.
+    std::atomic<re2::RE2*> re;
+    // Input of deferred compilation and of variants.
+    std::string pattern;
+    re2::RE2::Options re2opts;
+    // Built on first {capture, all_names, _} match, published like re.
+    std::atomic<re2_names*> names;
+    // RE2 keeps its lazily built DFA states in a cache behind a lock, which
+    // gets contended if many schedulers use one hot regex at once. With
+    // {replicas, N} the handle holds N independent copies, slot 0 being re
+    // and the others kept here, and every thread sticks to one of them.
+    std::vector<std::atomic<re2::RE2*>> replicas;
+    // Set once a match has used the slot, for re2:stats/1
+    std::vector<std::atomic<bool>> slot_used;
+    // The regex compiled with the variant_flag options of a call added,
+    // indexed by the added flags minus one. Compiled on first use and
+    // published like re.
+    std::atomic<re2::RE2*> variants[VF_ALL];
+    // Set at compile time if the pattern is a plain string
+    re2_literal literal;
+    // Cached re2:possible_match_range results
+    std::atomic<re2_range*> ranges;
+    // Cached re2:extract templates
+    std::atomic<re2_template*> templates;
+    // Totals of {warmup, Samples} and re2:warmup/2, for re2:stats/1
+    std::atomic<uint64_t> warmup_samples;
+    std::atomic<uint64_t> warmup_bytes;
+    std::atomic<int64_t> warmup_time;
+    // Searches where the DFA ran out of memory and RE2 fell back to the
+    // NFA, and DFA state cache resets, counted by the RE2 hooks.
+    std::atomic<uint64_t> dfa_failures;
+    std::atomic<uint64_t> dfa_cache_resets;
+    // The max_mem that RE2 objects are compiled with. {auto_max_mem,
+    // Ceiling} raises it up to max_mem_ceiling after DFA failures, see
+    // resize_handle(). The RE2 objects replaced then are freed once the
+    // calls that may still use them, counted in readers by handle_guard,
+    // are done.
+    std::atomic<int64_t> max_mem;
+    int64_t max_mem_ceiling;
+    std::atomic<bool> resize_pending;
+    std::atomic<bool> grow_pending;
+    // Set while the objects replaced last wait to be freed
+    std::atomic<bool> retiring;
+    std::atomic<int> epoch;
+    std::atomic<unsigned> readers[2];
+
+    re2_handle(
+        const re2::RE2::Options& opts, unsigned nreplicas, int64_t ceiling)
+    : re(nullptr)
+    , re2opts(opts)
+    , names(nullptr)
+    , replicas(nreplicas - 1)
+    , slot_used(nreplicas)
+    , ranges(nullptr)
+    , templates(nullptr)
+    , warmup_samples(0)
+    , warmup_bytes(0)
+    , warmup_time(0)
+    , dfa_failures(0)
+    , dfa_cache_resets(0)
+    , max_mem(opts.max_mem())
+    , max_mem_ceiling(ceiling)
+    , resize_pending(false)
+    , grow_pending(false)
+    , retiring(false)
+    , epoch(0)
+    {
+        for (auto& replica : replicas)
+            replica = nullptr;
+        for (auto& used : slot_used)
+            used = false;
+        for (auto& count : readers)
+            count = 0;
+        for (auto& variant : variants)
+            variant = nullptr;
+    }
+
+    ~re2_handle()
+    {
+        re2::RE2* ptr = re.load();
+        cleanup_obj_ptr(ptr);
+        for (auto& replica : replicas) {
+            ptr = replica.load();
+            cleanup_obj_ptr(ptr);
+        }
+        for (auto& variant : variants) {
+            ptr = variant.load();
+            cleanup_obj_ptr(ptr);
+        }
+        re2_names* nptr = names.load();
+        cleanup_obj_ptr(nptr);
+        re2_range* range = ranges.load();
+        while (range != nullptr) {
+            re2_range* next = range->next;
+            cleanup_obj_ptr(range);
+            range = next;
+        }
+        re2_template* tmpl = templates.load();
+        while (tmpl != nullptr) {
+            re2_template* next = tmpl->next;
+            cleanup_obj_ptr(tmpl);
+            tmpl = next;
+        }
+    }
 };
 
 //
@@ -109,6 +365,36 @@ union re2_handle_union
     re2_handle* p;
 };
 
+//
+// One step of a re2:pipeline_new/1 pipeline. The step keeps the handle
+// resource alive until the pipeline is garbage collected.
+//
+struct pipeline_step
+{
+    re2_handle* handle;
+    std::string rewrite;
+    bool global;
+    // Number of groups the rewrite refers to, plus \0
+    int nvec;
+};
+
+struct re2_pipeline
+{
+    std::vector<pipeline_step> steps;
+
+    ~re2_pipeline()
+    {
+        for (auto& step : steps)
+            enif_release_resource(step.handle);
+    }
+};
+
+union re2_pipeline_union
+{
+    void* vp;
+    re2_pipeline* p;
+};
+
 #if ERL_NIF_MAJOR_VERSION > 2                                                 \
     || (ERL_NIF_MAJOR_VERSION == 2 && ERL_NIF_MINOR_VERSION >= 7)
 #define NIF_FUNC_ENTRY(name, arity, fun)                                      \
@@ -122,6 +408,11 @@ union re2_handle_union
     }
 #endif
 
+#if ERL_NIF_MAJOR_VERSION > 2                                                 \
+    || (ERL_NIF_MAJOR_VERSION == 2 && ERL_NIF_MINOR_VERSION >= 14)
+#define RE2_HAVE_MAP_FROM_ARRAYS 1
+#endif
+
 #if ERL_NIF_MAJOR_VERSION > 2
 #define RE2_HAVE_DIRTY_SCHEDULERS 1
 #elif ERL_NIF_MAJOR_VERSION == 2
@@ -147,6 +438,7 @@ static bool have_online_dirty_schedulers()
 }
 
 #define DS_MODE ERL_NIF_DIRTY_JOB_CPU_BOUND
+#define DS_IO_MODE ERL_NIF_DIRTY_JOB_IO_BOUND
 #define SCHEDULE_NIF enif_schedule_nif
 
 #else
@@ -157,6 +449,7 @@ static bool have_online_dirty_schedulers()
 }
 
 #define DS_MODE 0
+#define DS_IO_MODE 0
 static ERL_NIF_TERM SCHEDULE_NIF(
     ErlNifEnv* env,
     const char*,  // fun_name
@@ -171,7 +464,11 @@ static ERL_NIF_TERM SCHEDULE_NIF(
 
 // static variables
 static int ds_flags                          = 0;
+static int ds_io_flags                       = 0;
+// erlang:system_info(dirty_cpu_schedulers), passed as load info
+static unsigned dirty_cpu_schedulers         = 0;
 static ErlNifResourceType* re2_resource_type = nullptr;
+static ErlNifResourceType* re2_pipeline_type = nullptr;
 static ERL_NIF_TERM a_ok;
 static ERL_NIF_TERM a_error;
 static ERL_NIF_TERM a_match;
@@ -179,14 +476,59 @@ static ERL_NIF_TERM a_nomatch;
 static ERL_NIF_TERM a_capture;
 static ERL_NIF_TERM a_global;
 static ERL_NIF_TERM a_offset;
+static ERL_NIF_TERM a_limit;
+static ERL_NIF_TERM a_anchor;
+static ERL_NIF_TERM a_start;
+static ERL_NIF_TERM a_both;
 static ERL_NIF_TERM a_all;
 static ERL_NIF_TERM a_all_but_first;
+static ERL_NIF_TERM a_all_names;
 static ERL_NIF_TERM a_first;
 static ERL_NIF_TERM a_none;
 static ERL_NIF_TERM a_index;
 static ERL_NIF_TERM a_binary;
+static ERL_NIF_TERM a_map;
+static ERL_NIF_TERM a_char_index;
 static ERL_NIF_TERM a_caseless;
+static ERL_NIF_TERM a_latin1;
+static ERL_NIF_TERM a_never_capture;
 static ERL_NIF_TERM a_max_mem;
+static ERL_NIF_TERM a_lazy;
+static ERL_NIF_TERM a_replicas;
+static ERL_NIF_TERM a_per_scheduler;
+static ERL_NIF_TERM a_sequential;
+static ERL_NIF_TERM a_file_changed;
+static ERL_NIF_TERM a_true;
+static ERL_NIF_TERM a_infinity;
+static ERL_NIF_TERM a_call;
+static ERL_NIF_TERM a_replace;
+static ERL_NIF_TERM a_list;
+static ERL_NIF_TERM a_pattern_hash;
+static ERL_NIF_TERM a_pattern_prefix;
+static ERL_NIF_TERM a_pattern_size;
+static ERL_NIF_TERM a_subject_size;
+static ERL_NIF_TERM a_duration;
+static ERL_NIF_TERM a_scheduler;
+static ERL_NIF_TERM a_timestamp;
+static ERL_NIF_TERM a_normal;
+static ERL_NIF_TERM a_dirty_cpu;
+static ERL_NIF_TERM a_dirty_io;
+static ERL_NIF_TERM a_undefined;
+static ERL_NIF_TERM a_unbounded;
+static ERL_NIF_TERM a_warmup;
+static ERL_NIF_TERM a_program_size;
+static ERL_NIF_TERM a_reverse_program_size;
+static ERL_NIF_TERM a_literal;
+static ERL_NIF_TERM a_warmup_samples;
+static ERL_NIF_TERM a_warmup_bytes;
+static ERL_NIF_TERM a_warmup_time;
+static ERL_NIF_TERM a_bad_rewrite;
+static ERL_NIF_TERM a_bad_template;
+static ERL_NIF_TERM a_auto_max_mem;
+static ERL_NIF_TERM a_dfa_failures;
+static ERL_NIF_TERM a_dfa_cache_resets;
+static ERL_NIF_TERM a_replicas_used;
+static ERL_NIF_TERM a_false;
 static ERL_NIF_TERM a_err_enif_alloc_binary;
 static ERL_NIF_TERM a_err_enif_alloc_resource;
 static ERL_NIF_TERM a_err_enif_alloc;
@@ -217,14 +559,59 @@ static void init_atoms(ErlNifEnv* env)
     a_capture                    = enif_make_atom(env, "capture");
     a_global                     = enif_make_atom(env, "global");
     a_offset                     = enif_make_atom(env, "offset");
+    a_limit                      = enif_make_atom(env, "limit");
+    a_anchor                     = enif_make_atom(env, "anchor");
+    a_start                      = enif_make_atom(env, "start");
+    a_both                       = enif_make_atom(env, "both");
     a_all                        = enif_make_atom(env, "all");
     a_all_but_first              = enif_make_atom(env, "all_but_first");
+    a_all_names                  = enif_make_atom(env, "all_names");
     a_first                      = enif_make_atom(env, "first");
     a_none                       = enif_make_atom(env, "none");
     a_index                      = enif_make_atom(env, "index");
     a_binary                     = enif_make_atom(env, "binary");
+    a_map                        = enif_make_atom(env, "map");
+    a_char_index                 = enif_make_atom(env, "char_index");
     a_caseless                   = enif_make_atom(env, "caseless");
+    a_latin1                     = enif_make_atom(env, "latin1");
+    a_never_capture              = enif_make_atom(env, "never_capture");
     a_max_mem                    = enif_make_atom(env, "max_mem");
+    a_lazy                       = enif_make_atom(env, "lazy");
+    a_replicas                   = enif_make_atom(env, "replicas");
+    a_per_scheduler              = enif_make_atom(env, "per_scheduler");
+    a_sequential                 = enif_make_atom(env, "sequential");
+    a_file_changed               = enif_make_atom(env, "file_changed");
+    a_true                       = enif_make_atom(env, "true");
+    a_infinity                   = enif_make_atom(env, "infinity");
+    a_call                       = enif_make_atom(env, "call");
+    a_replace                    = enif_make_atom(env, "replace");
+    a_list                       = enif_make_atom(env, "list");
+    a_pattern_hash               = enif_make_atom(env, "pattern_hash");
+    a_pattern_prefix             = enif_make_atom(env, "pattern_prefix");
+    a_pattern_size               = enif_make_atom(env, "pattern_size");
+    a_subject_size               = enif_make_atom(env, "subject_size");
+    a_duration                   = enif_make_atom(env, "duration");
+    a_scheduler                  = enif_make_atom(env, "scheduler");
+    a_timestamp                  = enif_make_atom(env, "timestamp");
+    a_normal                     = enif_make_atom(env, "normal");
+    a_dirty_cpu                  = enif_make_atom(env, "dirty_cpu");
+    a_dirty_io                   = enif_make_atom(env, "dirty_io");
+    a_undefined                  = enif_make_atom(env, "undefined");
+    a_unbounded                  = enif_make_atom(env, "unbounded");
+    a_warmup                     = enif_make_atom(env, "warmup");
+    a_program_size               = enif_make_atom(env, "program_size");
+    a_reverse_program_size       = enif_make_atom(env, "reverse_program_size");
+    a_literal                    = enif_make_atom(env, "literal");
+    a_warmup_samples             = enif_make_atom(env, "warmup_samples");
+    a_warmup_bytes               = enif_make_atom(env, "warmup_bytes");
+    a_warmup_time                = enif_make_atom(env, "warmup_time");
+    a_bad_rewrite                = enif_make_atom(env, "bad_rewrite");
+    a_bad_template               = enif_make_atom(env, "bad_template");
+    a_auto_max_mem               = enif_make_atom(env, "auto_max_mem");
+    a_dfa_failures               = enif_make_atom(env, "dfa_failures");
+    a_dfa_cache_resets           = enif_make_atom(env, "dfa_cache_resets");
+    a_replicas_used              = enif_make_atom(env, "replicas_used");
+    a_false                      = enif_make_atom(env, "false");
     a_err_enif_alloc_binary      = enif_make_atom(env, "enif_alloc_binary");
     a_err_enif_alloc_resource    = enif_make_atom(env, "enif_alloc_resource");
     a_err_enif_alloc             = enif_make_atom(env, "enif_alloc");
@@ -249,7 +636,288 @@ static void init_atoms(ErlNifEnv* env)
 
 static void cleanup_handle(re2_handle* handle)
 {
-    cleanup_obj_ptr(handle->re);
+    handle->~re2_handle();
+}
+
+//
+// Allocate a resource and construct a re2_handle in it
+//
+static re2_handle* alloc_handle(const compileoptions& opts)
+{
+    void* mem = enif_alloc_resource(re2_resource_type, sizeof(re2_handle));
+    if (mem == nullptr)
+        return nullptr;
+    // placement new
+    return new (mem)
+        re2_handle(opts.re2opts, opts.replicas, opts.auto_max_mem);
+}
+
+//
+// Compile pattern into an enif allocated RE2 object. Returns nullptr only if
+// allocation fails, compile errors are reported via RE2::ok().
+//
+static re2::RE2* new_re2(
+    const re2::StringPiece& p, const re2::RE2::Options& re2opts)
+{
+    re2::RE2* re2 = (re2::RE2*)enif_alloc(sizeof(re2::RE2));
+    if (re2 == nullptr)
+        return nullptr;
+    return new (re2) re2::RE2(p, re2opts);  // placement new
+}
+
+//
+// Compile the handle's regex and all of its replicas. Returns false if
+// allocation fails. Replicas are only compiled if the regex is ok().
+//
+static bool compile_handle(re2_handle* handle, const re2::StringPiece& p)
+{
+    re2::RE2* re = new_re2(p, handle->re2opts);
+    if (re == nullptr)
+        return false;
+    handle->re = re;
+
+    if (!re->ok())
+        return true;
+
+    for (auto& replica : handle->replicas) {
+        re2::RE2* copy = new_re2(p, handle->re2opts);
+        if (copy == nullptr) {
+            // Report the allocation failure through re as well.
+            handle->re = nullptr;
+            cleanup_obj_ptr(re);
+            return false;
+        }
+        replica = copy;
+    }
+
+    return true;
+}
+
+//
+// Small per-thread number, handed out in order of first use among threads
+// of the same kind. Scheduler threads live as long as the VM, so the dirty
+// CPU schedulers, which run the matches when they are online, get slots 0
+// to N-1 and are spread evenly over the replicas of a regex. Normal and
+// dirty IO schedulers and other threads are numbered on their own.
+//
+static unsigned thread_slot()
+{
+#ifdef ERL_NIF_THR_NORMAL_SCHEDULER
+    static std::atomic<unsigned> next_slot[4];
+    static thread_local unsigned slot = [] {
+        const int type = enif_thread_type();
+        return next_slot[type > 0 && type < 4 ? type : 0].fetch_add(1);
+    }();
+#else
+    static std::atomic<unsigned> next_slot(0);
+    static thread_local unsigned slot = next_slot.fetch_add(1);
+#endif
+    return slot;
+}
+
+//
+// The options to compile the handle's RE2 objects with, which has the
+// current max_mem if {auto_max_mem, Ceiling} has raised it
+//
+static re2::RE2::Options handle_options(const re2_handle* handle)
+{
+    re2::RE2::Options re2opts = handle->re2opts;
+    re2opts.set_max_mem(handle->max_mem.load(std::memory_order_relaxed));
+    return re2opts;
+}
+
+static void request_resize(re2_handle* handle, bool grow);
+static void resize_wake();
+
+//
+// A lazily compiled RE2 object may have been made with a max_mem that
+// resize_handle() has raised since, after it passed over the empty slot.
+// Have it recompiled then.
+//
+static void check_max_mem(re2_handle* handle, const re2::RE2* re)
+{
+    if (handle->max_mem_ceiling > 0
+        && re->options().max_mem() != handle->max_mem.load())
+        request_resize(handle, false);
+}
+
+//
+// Marks the calling thread as possibly using RE2 objects of the handle
+// while in scope, so that resize_handle() doesn't free the ones it replaces
+// under it. Enter before loading any of them. Only handles with
+// {auto_max_mem, Ceiling} ever replace them, the others skip the shared
+// counters.
+//
+struct handle_guard
+{
+    re2_handle* handle;
+    int epoch;
+
+    handle_guard()
+    : handle(nullptr)
+    , epoch(-1)
+    {}
+
+    explicit handle_guard(re2_handle* h)
+    : handle(nullptr)
+    , epoch(-1)
+    {
+        enter(h);
+    }
+
+    ~handle_guard()
+    {
+        if (epoch >= 0 && handle->readers[epoch].fetch_sub(1) == 1
+            && handle->retiring.load())
+            resize_wake();
+    }
+
+    handle_guard(const handle_guard&) = delete;
+    handle_guard& operator=(const handle_guard&) = delete;
+
+    void enter(re2_handle* h)
+    {
+        if (h->max_mem_ceiling == 0)
+            return;
+        handle = h;
+        // Count in the current epoch, which the resize thread flips before
+        // it waits for the readers of the old one
+        for (;;) {
+            epoch = h->epoch.load();
+            h->readers[epoch].fetch_add(1);
+            if (h->epoch.load() == epoch)
+                return;
+            h->readers[epoch].fetch_sub(1);
+        }
+    }
+};
+
+//
+// Get the RE2 object in slot i, 0 being re and the others the replicas,
+// compiling it first if the regex is lazy. Returns nullptr if allocation
+// fails.
+//
+static re2::RE2* handle_slot_re(re2_handle* handle, size_t i)
+{
+    std::atomic<re2::RE2*>* slot
+        = i > 0 ? &handle->replicas[i - 1] : &handle->re;
+
+    re2::RE2* re = slot->load(std::memory_order_acquire);
+    if (re != nullptr)
+        return re;
+
+    re2::RE2* fresh = new_re2(handle->pattern, handle_options(handle));
+    if (fresh == nullptr)
+        return nullptr;
+
+    if (slot->compare_exchange_strong(re, fresh)) {
+        check_max_mem(handle, fresh);
+        return fresh;
+    }
+
+    // Another thread published its copy first, use that one.
+    cleanup_obj_ptr(fresh);
+    return re;
+}
+
+//
+// Get the RE2 object the calling thread should use
+//
+static re2::RE2* handle_re(re2_handle* handle)
+{
+    const size_t nslots = handle->replicas.size() + 1;
+    const size_t i      = nslots > 1 ? thread_slot() % nslots : 0;
+    if (!handle->slot_used[i].load(std::memory_order_relaxed))
+        handle->slot_used[i].store(true, std::memory_order_relaxed);
+    return handle_slot_re(handle, i);
+}
+
+//
+// Get the handle's sorted capture group names, building them on first use.
+// Returns nullptr if allocation fails.
+//
+static const re2_names* handle_names(re2_handle* handle, const re2::RE2& re)
+{
+    re2_names* names = handle->names.load(std::memory_order_acquire);
+    if (names != nullptr)
+        return names;
+
+    void* mem = enif_alloc(sizeof(re2_names));
+    if (mem == nullptr)
+        return nullptr;
+    re2_names* fresh = new (mem) re2_names(re);  // placement new
+
+    if (handle->names.compare_exchange_strong(
+            names,
+            fresh,
+            std::memory_order_acq_rel,
+            std::memory_order_acquire))
+        return fresh;
+
+    cleanup_obj_ptr(fresh);
+    return names;
+}
+
+//
+// caseless | latin1 | never_capture
+//
+static bool get_variant_option(const ERL_NIF_TERM opt, unsigned* flag)
+{
+    if (enif_is_identical(opt, a_caseless))
+        *flag = VF_CASELESS;
+    else if (enif_is_identical(opt, a_latin1))
+        *flag = VF_LATIN1;
+    else if (enif_is_identical(opt, a_never_capture))
+        *flag = VF_NEVER_CAPTURE;
+    else
+        return false;
+    return true;
+}
+
+static void set_variant_options(re2::RE2::Options& re2opts, unsigned variant)
+{
+    if (variant & VF_CASELESS)
+        re2opts.set_case_sensitive(false);
+    if (variant & VF_LATIN1)
+        re2opts.set_encoding(re2::RE2::Options::EncodingLatin1);
+    if (variant & VF_NEVER_CAPTURE)
+        re2opts.set_never_capture(true);
+}
+
+// The variant_flag options of a call that the handle wasn't compiled with
+static unsigned handle_variant(const re2_handle* handle, unsigned variant)
+{
+    const re2::RE2::Options& re2opts = handle->re2opts;
+    if (!re2opts.case_sensitive())
+        variant &= ~VF_CASELESS;
+    if (re2opts.encoding() == re2::RE2::Options::EncodingLatin1)
+        variant &= ~VF_LATIN1;
+    if (re2opts.never_capture())
+        variant &= ~VF_NEVER_CAPTURE;
+    return variant;
+}
+
+static re2::RE2* handle_variant_re(re2_handle* handle, unsigned variant)
+{
+    std::atomic<re2::RE2*>& slot = handle->variants[variant - 1];
+
+    re2::RE2* re = slot.load(std::memory_order_acquire);
+    if (re != nullptr)
+        return re;
+
+    re2::RE2::Options re2opts = handle_options(handle);
+    set_variant_options(re2opts, variant);
+    re2::RE2* fresh = new_re2(handle->pattern, re2opts);
+    if (fresh == nullptr)
+        return nullptr;
+
+    if (slot.compare_exchange_strong(re, fresh)) {
+        check_max_mem(handle, fresh);
+        return fresh;
+    }
+
+    cleanup_obj_ptr(fresh);
+    return re;
 }
 
 //
@@ -346,95 +1014,883 @@ static char* alloc_str(ErlNifEnv* env, const ERL_NIF_TERM list, unsigned* len)
     return (char*)enif_alloc(list_len);
 }
 
-// ===========
-// re2:compile
-// ===========
+// ================
+// literal patterns
+// ================
+
+// Longest uncompiled literal that's matched without building an RE2 object.
+// Compiled regexes are always built, so errors like a too small max_mem are
+// reported as before.
+static const size_t max_adhoc_literal = 1024;
+
+static bool is_metachar(char c)
+{
+    return c != '\0' && strchr("\\.+*?()|[]{}^$", c) != nullptr;
+}
 
 //
-// Options = [ Option ]
-// Option = caseless | {max_mem, int()}
+// Check if p is a plain string for RE2 and store it in lit if so. Only ASCII
+// patterns qualify, where metacharacters may be escaped and \t \n \r \f \v
+// are allowed. Caseless patterns are left to RE2, which beats a byte by
+// byte case folding scan.
 //
-static bool parse_compile_options(
-    ErlNifEnv* env, const ERL_NIF_TERM list, re2::RE2::Options& opts)
+static bool parse_literal(
+    const re2::StringPiece& p,
+    const re2::RE2::Options& re2opts,
+    re2_literal& lit)
 {
-    if (enif_is_empty_list(env, list))
-        return true;
-
-    ERL_NIF_TERM L, H, T;
-
-    for (L = list; enif_get_list_cell(env, L, &H, &T); L = T) {
-        const ERL_NIF_TERM* tuple;
-        int tuplearity = -1;
-
-        if (enif_is_identical(H, a_caseless)) {
-
-            // caseless
-
-            opts.set_case_sensitive(false);
-        } else if (enif_get_tuple(env, H, &tuplearity, &tuple)) {
-
-            if (tuplearity == 2) {
+    if (p.empty() || re2opts.posix_syntax() || re2opts.literal()
+        || re2opts.never_nl() || !re2opts.case_sensitive())
+        return false;
 
-                if (enif_is_identical(tuple[0], a_max_mem)) {
+    std::string text;
+    text.reserve(p.size());
 
-                    // {max_mem, int()}
+    for (size_t i = 0; i < p.size(); i++) {
+        char c = p[i];
+        if ((unsigned char)c >= 0x80)
+            return false;
 
-                    int max_mem = 0;
-                    if (enif_get_int(env, tuple[1], &max_mem))
-                        opts.set_max_mem(max_mem);
-                    else
-                        return false;
-                }
+        if (c == '\\') {
+            if (++i == p.size())
+                return false;
+            c = p[i];
+            switch (c) {
+            case 't':
+                c = '\t';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'v':
+                c = '\v';
+                break;
+            default:
+                if (!is_metachar(c))
+                    return false;
             }
-        } else {
+        } else if (is_metachar(c)) {
             return false;
         }
+        text.push_back(c);
     }
 
+    lit.valid = true;
+    lit.text.swap(text);
     return true;
 }
 
-static ERL_NIF_TERM re2_compile_impl(
-    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static bool literal_at(const re2_literal& lit, const char* s)
 {
-    ErlNifBinary pdata;
+    return memcmp(s, lit.text.data(), lit.text.size()) == 0;
+}
 
-    if (enif_inspect_iolist_as_binary(env, argv[0], &pdata)) {
-        const re2::StringPiece p((const char*)pdata.data, pdata.size);
-        re2_handle* handle = (re2_handle*)enif_alloc_resource(
-            re2_resource_type, sizeof(re2_handle));
+//
+// Find the first occurrence of lit in s at or after pos. Returns its offset
+// or npos.
+//
+static size_t literal_find(
+    const re2_literal& lit, const re2::StringPiece& s, size_t pos)
+{
+    const size_t m = lit.text.size();
+    if (pos > s.size() || s.size() - pos < m)
+        return re2::StringPiece::npos;
+
+    const char* data  = s.data();
+    const size_t last = s.size() - m;  // last possible start of a match
+
+    const char first = lit.text[0];
+    while (pos <= last) {
+        const void* hit = memchr(data + pos, first, last - pos + 1);
+        if (hit == nullptr)
+            break;
+        pos = (const char*)hit - data;
+        if (literal_at(lit, data + pos))
+            return pos;
+        pos++;
+    }
 
-        if (handle == nullptr) {
-            return error(env, a_err_enif_alloc_resource);
+    return re2::StringPiece::npos;
+}
+
+//
+// Same as RE2::Rewrite() for a regex without capturing groups, \0 is the
+// match. RE2::MaxSubmatch(rewrite) must be 0.
+//
+static bool literal_rewrite(
+    std::string* out,
+    const re2::StringPiece& rewrite,
+    const re2::StringPiece& match)
+{
+    const char* end = rewrite.data() + rewrite.size();
+    for (const char* s = rewrite.data(); s < end; s++) {
+        if (*s != '\\') {
+            out->push_back(*s);
+            continue;
         }
+        s++;
+        const int c = (s < end) ? *s : -1;
+        if (c == '0')
+            out->append(match.data(), match.size());
+        else if (c == '\\')
+            out->push_back('\\');
+        else
+            return false;
+    }
+    return true;
+}
 
-        handle->re = nullptr;
+//
+// Same as RE2::Replace() for a literal
+//
+static bool literal_replace(
+    std::string* str, const re2_literal& lit, const re2::StringPiece& rewrite)
+{
+    // A rewrite referring to any group but \0 is rejected by RE2.
+    if (re2::RE2::MaxSubmatch(rewrite) > 0)
+        return false;
+
+    const size_t pos = literal_find(lit, *str, 0);
+    if (pos == re2::StringPiece::npos)
+        return false;
+
+    const re2::StringPiece match(str->data() + pos, lit.text.size());
+    std::string s;
+    if (!literal_rewrite(&s, rewrite, match))
+        return false;
+    str->replace(pos, match.size(), s);
+    return true;
+}
 
-        re2::RE2::Options re2opts;
-        re2opts.set_log_errors(false);
+//
+// Same as RE2::GlobalReplace() for a literal. A literal never matches the
+// empty string, so there's no need to step over empty matches.
+//
+static bool literal_global_replace(
+    std::string* str, const re2_literal& lit, const re2::StringPiece& rewrite)
+{
+    if (re2::RE2::MaxSubmatch(rewrite) > 0)
+        return false;
+
+    const size_t m = lit.text.size();
+    std::string out;
+    size_t p     = 0;
+    size_t count = 0;
+    size_t pos;
+
+    while ((pos = literal_find(lit, *str, p)) != re2::StringPiece::npos) {
+        out.append(*str, p, pos - p);
+        // RE2::GlobalReplace() ignores rewrite errors as well
+        literal_rewrite(&out, rewrite, re2::StringPiece(str->data() + pos, m));
+        p = pos + m;
+        count++;
+    }
 
-        if (argc == 2 && !parse_compile_options(env, argv[1], re2opts)) {
-            cleanup_handle(handle);
-            enif_release_resource(handle);
-            return enif_make_badarg(env);
-        }
+    if (count == 0)
+        return false;
 
-        re2::RE2* re2 = (re2::RE2*)enif_alloc(sizeof(re2::RE2));
-        if (re2 == nullptr) {
-            cleanup_handle(handle);
-            enif_release_resource(handle);
-            return error(env, a_err_enif_alloc);
-        }
-        handle->re = new (re2) re2::RE2(p, re2opts);  // placement new
+    out.append(*str, p, std::string::npos);
+    str->swap(out);
+    return true;
+}
 
-        if (!handle->re->ok()) {
-            ERL_NIF_TERM error = re2error(env, *(handle->re));
-            cleanup_handle(handle);
-            enif_release_resource(handle);
-            return error;
-        }
+// =================
+// DFA memory budget
+// =================
 
-        ERL_NIF_TERM result = enif_make_resource(env, handle);
+//
+// RE2 reports DFA cache resets and searches that ran out of DFA memory,
+// after which it falls back to the much slower NFA, through hooks. The
+// hooks are not exported from every RE2 shared library, so they are
+// declared weak and only used if present.
+//
+#if defined(__GNUC__) && !defined(_WIN32)
+#define RE2_HAVE_DFA_HOOKS 1
+namespace re2 {
+namespace hooks {
+void SetDFAStateCacheResetHook(DFAStateCacheResetCallback* cb)
+    __attribute__((weak));
+DFAStateCacheResetCallback* GetDFAStateCacheResetHook() __attribute__((weak));
+void SetDFASearchFailureHook(DFASearchFailureCallback* cb)
+    __attribute__((weak));
+DFASearchFailureCallback* GetDFASearchFailureHook() __attribute__((weak));
+}  // namespace hooks
+}  // namespace re2
+#endif
+
+// Set if the hooks are installed and the counters are meaningful
+static bool have_dfa_hooks = false;
+#ifdef RE2_HAVE_DFA_HOOKS
+static re2::hooks::DFAStateCacheResetCallback* prev_cache_reset_hook;
+static re2::hooks::DFASearchFailureCallback* prev_search_failure_hook;
+#endif
+
+// The handle whose RE2 object this thread is matching with, which the hooks
+// account to. Set with a dfa_scope.
+static thread_local re2_handle* dfa_handle = nullptr;
+
+struct dfa_scope
+{
+    re2_handle* prev;
+
+    explicit dfa_scope(re2_handle* handle)
+    : prev(dfa_handle)
+    {
+        dfa_handle = handle;
+    }
+
+    ~dfa_scope() { dfa_handle = prev; }
+};
+
+//
+// The resize thread, started by on_load() if RE2 has the DFA hooks, and its
+// work: the handles queued by request_resize(), and the RE2 objects that
+// resize_handle() replaced, which wait for the calls that may still use
+// them. Both hold a resource reference to their handle.
+//
+struct retirement
+{
+    re2_handle* handle;
+    int epoch;
+    std::vector<re2::RE2*> objects;
+};
+
+struct resizer
+{
+    ErlNifMutex* mutex;  // guards all of the below
+    ErlNifCond* cond;
+    ErlNifTid tid;
+    std::vector<re2_handle*> queue;
+    std::vector<retirement> retired;
+    // Set by resize_wake(), so a wakeup while the thread is busy isn't lost
+    bool woken;
+    bool stop;
+
+    resizer()
+    : mutex(nullptr)
+    , cond(nullptr)
+    , woken(false)
+    , stop(false)
+    {}
+};
+
+static resizer* resize_state = nullptr;
+
+//
+// Wake the resize thread, called by the last reader of a retired epoch
+//
+static void resize_wake()
+{
+    resizer* r = resize_state;
+    if (r == nullptr)
+        return;
+    enif_mutex_lock(r->mutex);
+    r->woken = true;
+    enif_cond_signal(r->cond);
+    enif_mutex_unlock(r->mutex);
+}
+
+//
+// Recompile the RE2 objects of the handle that don't have the current
+// max_mem, after doubling it if grow, and swap them in. The replaced
+// objects are added to retired. Slots that haven't been compiled yet pick
+// up the new max_mem when they are.
+//
+static void resize_handle(
+    re2_handle* handle, bool grow, std::vector<re2::RE2*>& retired)
+{
+    if (grow) {
+        // Doubling {max_mem, 0} would never get anywhere
+        static const int64_t default_max_mem = re2::RE2::Options().max_mem();
+        const int64_t max_mem = handle->max_mem.load() * 2;
+        handle->max_mem.store(std::min(
+            std::max(max_mem, default_max_mem), handle->max_mem_ceiling));
+    }
+    const int64_t max_mem = handle->max_mem.load();
+
+    auto recompile = [&](std::atomic<re2::RE2*>& slot, unsigned variant) {
+        const re2::RE2* re = slot.load();
+        if (re == nullptr || re->options().max_mem() == max_mem)
+            return;
+        re2::RE2::Options re2opts = handle_options(handle);
+        set_variant_options(re2opts, variant);
+        re2::RE2* fresh = new_re2(handle->pattern, re2opts);
+        if (fresh == nullptr)
+            return;
+        if (!fresh->ok()) {
+            cleanup_obj_ptr(fresh);
+            return;
+        }
+        retired.push_back(slot.exchange(fresh));
+    };
+
+    recompile(handle->re, 0);
+    for (auto& replica : handle->replicas)
+        recompile(replica, 0);
+    for (unsigned i = 0; i < VF_ALL; i++)
+        recompile(handle->variants[i], i + 1);
+}
+
+//
+// True if a compiled RE2 object of the handle has an old max_mem
+//
+static bool handle_stale(re2_handle* handle)
+{
+    const int64_t max_mem = handle->max_mem.load();
+    auto stale = [max_mem](const std::atomic<re2::RE2*>& slot) {
+        const re2::RE2* re = slot.load();
+        return re != nullptr && re->options().max_mem() != max_mem;
+    };
+
+    if (stale(handle->re))
+        return true;
+    for (const auto& replica : handle->replicas)
+        if (stale(replica))
+            return true;
+    for (const auto& variant : handle->variants)
+        if (stale(variant))
+            return true;
+    return false;
+}
+
+static void free_retirement(retirement& t)
+{
+    for (re2::RE2* old : t.objects)
+        cleanup_obj_ptr(old);
+    t.handle->retiring.store(false);
+    enif_release_resource(t.handle);
+}
+
+//
+// Free the replaced objects whose epoch has no readers left. Called and
+// returns with r->mutex locked.
+//
+static void resize_reap(resizer* r)
+{
+    std::vector<retirement> done;
+    for (size_t i = 0; i < r->retired.size();) {
+        retirement& t = r->retired[i];
+        if (t.handle->readers[t.epoch].load() != 0) {
+            i++;
+            continue;
+        }
+        done.push_back(std::move(t));
+        if (i + 1 < r->retired.size())
+            t = std::move(r->retired.back());
+        r->retired.pop_back();
+    }
+    if (done.empty())
+        return;
+
+    enif_mutex_unlock(r->mutex);
+    for (retirement& t : done)
+        free_retirement(t);
+    enif_mutex_lock(r->mutex);
+}
+
+//
+// Take the next queued handle that has no objects waiting to be freed, as
+// its epoch can't be flipped again until they are. Called with r->mutex
+// locked.
+//
+static re2_handle* resize_next(resizer* r)
+{
+    for (size_t i = 0; i < r->queue.size(); i++) {
+        re2_handle* handle = r->queue[i];
+        if (!handle->retiring.load()) {
+            r->queue.erase(r->queue.begin() + i);
+            return handle;
+        }
+    }
+    return nullptr;
+}
+
+static void* resize_loop(void* arg)
+{
+    resizer* r = (resizer*)arg;
+
+    enif_mutex_lock(r->mutex);
+    for (;;) {
+        r->woken = false;
+        resize_reap(r);
+        if (r->stop)
+            break;
+
+        re2_handle* handle = resize_next(r);
+        if (handle == nullptr) {
+            if (!r->woken)
+                enif_cond_wait(r->cond, r->mutex);
+            continue;
+        }
+        enif_mutex_unlock(r->mutex);
+
+        std::vector<re2::RE2*> objects;
+        resize_handle(handle, handle->grow_pending.load(), objects);
+        if (!objects.empty()) {
+            // Calls that enter from here on only see the new objects. The
+            // last one to leave the old epoch wakes this thread.
+            handle->retiring.store(true);
+            handle->epoch.store(1 - handle->epoch.load());
+        }
+        // Further failures may ask for another doubling, and a lazy slot
+        // compiled meanwhile may have missed this one
+        handle->resize_pending.store(false);
+        if (handle_stale(handle))
+            request_resize(handle, false);
+
+        enif_mutex_lock(r->mutex);
+        if (objects.empty()) {
+            enif_release_resource(handle);
+        } else {
+            // The retirement takes over the reference
+            retirement t;
+            t.handle  = handle;
+            t.epoch   = 1 - handle->epoch.load();
+            t.objects = std::move(objects);
+            r->retired.push_back(std::move(t));
+        }
+    }
+    enif_mutex_unlock(r->mutex);
+    return nullptr;
+}
+
+//
+// Queue a handle with {auto_max_mem, Ceiling} for resize_handle(), to grow
+// its max_mem if it isn't at the ceiling yet, or to recompile objects with
+// an old one. Called from the hook, so it only takes a short lock.
+//
+static void request_resize(re2_handle* handle, bool grow)
+{
+    resizer* r = resize_state;
+    if (r == nullptr || handle->max_mem_ceiling == 0
+        || (grow && handle->max_mem.load() >= handle->max_mem_ceiling)
+        || handle->resize_pending.exchange(true))
+        return;
+    handle->grow_pending.store(grow);
+
+    enif_keep_resource(handle);
+    enif_mutex_lock(r->mutex);
+    r->queue.push_back(handle);
+    enif_cond_signal(r->cond);
+    enif_mutex_unlock(r->mutex);
+}
+
+static bool start_resizer()
+{
+    void* mem = enif_alloc(sizeof(resizer));
+    if (mem == nullptr)
+        return false;
+    resizer* r = new (mem) resizer();  // placement new
+
+    static char name[] = "re2_resize";
+    r->mutex           = enif_mutex_create(name);
+    r->cond            = enif_cond_create(name);
+    if (r->mutex != nullptr && r->cond != nullptr
+        && enif_thread_create(name, &r->tid, &resize_loop, r, nullptr)
+            == 0) {
+        resize_state = r;
+        return true;
+    }
+
+    if (r->cond != nullptr)
+        enif_cond_destroy(r->cond);
+    if (r->mutex != nullptr)
+        enif_mutex_destroy(r->mutex);
+    r->~resizer();
+    enif_free(r);
+    return false;
+}
+
+//
+// Stop the resize thread. No calls are running, so every replaced object
+// can be freed right away.
+//
+static void stop_resizer()
+{
+    resizer* r = resize_state;
+    if (r == nullptr)
+        return;
+
+    enif_mutex_lock(r->mutex);
+    r->stop = true;
+    enif_cond_signal(r->cond);
+    enif_mutex_unlock(r->mutex);
+    enif_thread_join(r->tid, nullptr);
+    resize_state = nullptr;
+
+    for (re2_handle* handle : r->queue)
+        enif_release_resource(handle);
+    for (retirement& t : r->retired)
+        free_retirement(t);
+    enif_cond_destroy(r->cond);
+    enif_mutex_destroy(r->mutex);
+    r->~resizer();
+    enif_free(r);
+}
+
+#ifdef RE2_HAVE_DFA_HOOKS
+static void dfa_cache_reset_hook(const re2::hooks::DFAStateCacheReset& r)
+{
+    prev_cache_reset_hook(r);
+    if (dfa_handle != nullptr)
+        dfa_handle->dfa_cache_resets.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void dfa_search_failure_hook(const re2::hooks::DFASearchFailure& f)
+{
+    prev_search_failure_hook(f);
+    if (dfa_handle != nullptr) {
+        dfa_handle->dfa_failures.fetch_add(1, std::memory_order_relaxed);
+        request_resize(dfa_handle, true);
+    }
+}
+#endif
+
+//
+// Install the hooks and start the resize thread for {auto_max_mem, Ceiling}.
+// Returns false if the thread can't be started.
+//
+static bool install_dfa_hooks()
+{
+#ifdef RE2_HAVE_DFA_HOOKS
+    if (&re2::hooks::SetDFAStateCacheResetHook == nullptr
+        || &re2::hooks::GetDFAStateCacheResetHook == nullptr
+        || &re2::hooks::SetDFASearchFailureHook == nullptr
+        || &re2::hooks::GetDFASearchFailureHook == nullptr)
+        return true;
+    if (!start_resizer())
+        return false;
+
+    prev_cache_reset_hook    = re2::hooks::GetDFAStateCacheResetHook();
+    prev_search_failure_hook = re2::hooks::GetDFASearchFailureHook();
+    re2::hooks::SetDFAStateCacheResetHook(&dfa_cache_reset_hook);
+    re2::hooks::SetDFASearchFailureHook(&dfa_search_failure_hook);
+    have_dfa_hooks = true;
+#endif
+    return true;
+}
+
+//
+// Put the hooks back and stop the resize thread before the library is
+// unloaded
+//
+static void uninstall_dfa_hooks()
+{
+#ifdef RE2_HAVE_DFA_HOOKS
+    if (have_dfa_hooks) {
+        re2::hooks::SetDFAStateCacheResetHook(prev_cache_reset_hook);
+        re2::hooks::SetDFASearchFailureHook(prev_search_failure_hook);
+        have_dfa_hooks = false;
+    }
+#endif
+    stop_resizer();
+}
+
+// ==========
+// re2:warmup
+// ==========
+
+//
+// Samples = [iodata()]
+//
+static bool get_samples(
+    ErlNifEnv* env,
+    const ERL_NIF_TERM list,
+    std::vector<re2::StringPiece>& samples)
+{
+    ERL_NIF_TERM L, H, T;
+
+    for (L = list; enif_get_list_cell(env, L, &H, &T); L = T) {
+        ErlNifBinary sdata;
+        if (!enif_inspect_iolist_as_binary(env, H, &sdata))
+            return false;
+        samples.push_back(
+            re2::StringPiece((const char*)sdata.data, sdata.size));
+    }
+
+    return enif_is_empty_list(env, L);
+}
+
+//
+// Run the samples through every RE2 object of the handle, so that RE2
+// builds the DFA states they need before the first real match. Matching
+// with no groups runs the forward DFA, asking for the match bounds runs
+// the reverse one as well, and an anchored match starts from other
+// states. Returns false if allocation fails.
+//
+static bool warmup_handle(
+    re2_handle* handle, const std::vector<re2::StringPiece>& samples)
+{
+    const ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+    uint64_t bytes         = 0;
+    handle_guard guard(handle);
+
+    for (size_t i = 0; i <= handle->replicas.size(); i++) {
+        const re2::RE2* re = handle_slot_re(handle, i);
+        if (re == nullptr)
+            return false;
+        if (!re->ok())
+            return true;
+
+        dfa_scope scope(handle);
+        re2::StringPiece match;
+        for (const auto& sample : samples) {
+            re->Match(
+                sample, 0, sample.size(), re2::RE2::UNANCHORED, nullptr, 0);
+            re->Match(
+                sample, 0, sample.size(), re2::RE2::UNANCHORED, &match, 1);
+            re->Match(
+                sample, 0, sample.size(), re2::RE2::ANCHOR_START, &match, 1);
+            if (i == 0)
+                bytes += sample.size();
+        }
+    }
+
+    handle->warmup_samples += samples.size();
+    handle->warmup_bytes += bytes;
+    handle->warmup_time += enif_monotonic_time(ERL_NIF_USEC) - start;
+    return true;
+}
+
+static ERL_NIF_TERM re2_warmup_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    union re2_handle_union handle;
+    std::vector<re2::StringPiece> samples;
+
+    if (!enif_get_resource(env, argv[0], re2_resource_type, &handle.vp)
+        || !get_samples(env, argv[1], samples))
+        return enif_make_badarg(env);
+
+    handle_guard guard(handle.p);
+    re2::RE2* re = handle_slot_re(handle.p, 0);
+    if (re == nullptr)
+        return error(env, a_err_enif_alloc);
+    if (!re->ok())
+        return enif_make_badarg(env);
+
+    if (!warmup_handle(handle.p, samples))
+        return error(env, a_err_enif_alloc);
+    return a_ok;
+}
+
+// =========
+// re2:stats
+// =========
+
+static ERL_NIF_TERM re2_stats_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    union re2_handle_union handle;
+
+    if (!enif_get_resource(env, argv[0], re2_resource_type, &handle.vp))
+        return enif_make_badarg(env);
+
+    handle_guard guard(handle.p);
+    re2::RE2* re = handle_slot_re(handle.p, 0);
+    if (re == nullptr)
+        return error(env, a_err_enif_alloc);
+    if (!re->ok())
+        return enif_make_badarg(env);
+
+    // The counters are undefined if RE2 doesn't provide the hooks
+    const ERL_NIF_TERM dfa_failures = have_dfa_hooks
+        ? enif_make_uint64(env, handle.p->dfa_failures.load())
+        : a_undefined;
+    const ERL_NIF_TERM dfa_cache_resets = have_dfa_hooks
+        ? enif_make_uint64(env, handle.p->dfa_cache_resets.load())
+        : a_undefined;
+
+    unsigned replicas_used = 0;
+    for (const auto& used : handle.p->slot_used)
+        replicas_used += used.load(std::memory_order_relaxed);
+
+    const size_t nkeys = 11;
+    ERL_NIF_TERM keys[nkeys]
+        = {a_program_size,
+           a_reverse_program_size,
+           a_replicas,
+           a_replicas_used,
+           a_literal,
+           a_warmup_samples,
+           a_warmup_bytes,
+           a_warmup_time,
+           a_dfa_failures,
+           a_dfa_cache_resets,
+           a_max_mem};
+    ERL_NIF_TERM values[nkeys]
+        = {enif_make_int(env, re->ProgramSize()),
+           enif_make_int(env, re->ReverseProgramSize()),
+           enif_make_uint(env, (unsigned)handle.p->replicas.size() + 1),
+           enif_make_uint(env, replicas_used),
+           handle.p->literal.valid ? a_true : a_false,
+           enif_make_uint64(env, handle.p->warmup_samples.load()),
+           enif_make_uint64(env, handle.p->warmup_bytes.load()),
+           enif_make_int64(env, handle.p->warmup_time.load()),
+           dfa_failures,
+           dfa_cache_resets,
+           enif_make_int64(env, handle.p->max_mem.load())};
+
+    ERL_NIF_TERM map;
+#ifdef RE2_HAVE_MAP_FROM_ARRAYS
+    enif_make_map_from_arrays(env, keys, values, nkeys, &map);
+#else
+    map = enif_make_new_map(env);
+    for (size_t i = 0; i < nkeys; i++)
+        enif_make_map_put(env, map, keys[i], values[i], &map);
+#endif
+    return map;
+}
+
+// ===========
+// re2:compile
+// ===========
+
+static const unsigned max_replicas = 1024;
+
+//
+// Options = [ Option ]
+// Option = caseless | latin1 | never_capture | {max_mem, int()}
+//          | {lazy, boolean()} | {replicas, pos_integer() | per_scheduler}
+//          | {warmup, [iodata()]} | {auto_max_mem, pos_integer()}
+//
+static bool parse_compile_options(
+    ErlNifEnv* env, const ERL_NIF_TERM list, compileoptions& opts)
+{
+    if (enif_is_empty_list(env, list))
+        return true;
+
+    ERL_NIF_TERM L, H, T;
+
+    for (L = list; enif_get_list_cell(env, L, &H, &T); L = T) {
+        const ERL_NIF_TERM* tuple;
+        int tuplearity = -1;
+        unsigned flag;
+
+        if (get_variant_option(H, &flag)) {
+
+            // caseless | latin1 | never_capture
+
+            set_variant_options(opts.re2opts, flag);
+        } else if (enif_get_tuple(env, H, &tuplearity, &tuple)) {
+
+            if (tuplearity == 2) {
+
+                if (enif_is_identical(tuple[0], a_max_mem)) {
+
+                    // {max_mem, int()}
+
+                    int max_mem = 0;
+                    if (enif_get_int(env, tuple[1], &max_mem))
+                        opts.re2opts.set_max_mem(max_mem);
+                    else
+                        return false;
+                } else if (enif_is_identical(tuple[0], a_auto_max_mem)) {
+
+                    // {auto_max_mem, pos_integer()}, which needs the hooks
+                    // to see DFA failures
+
+                    ErlNifSInt64 ceiling = 0;
+                    if (!enif_get_int64(env, tuple[1], &ceiling)
+                        || ceiling <= 0 || !have_dfa_hooks)
+                        return false;
+                    opts.auto_max_mem = ceiling;
+                } else if (enif_is_identical(tuple[0], a_lazy)) {
+
+                    // {lazy, boolean()}
+
+                    if (enif_is_identical(tuple[1], a_true))
+                        opts.lazy = true;
+                    else if (enif_is_identical(tuple[1], a_false))
+                        opts.lazy = false;
+                    else
+                        return false;
+                } else if (enif_is_identical(tuple[0], a_replicas)) {
+
+                    // {replicas, pos_integer() | per_scheduler}
+
+                    unsigned replicas = 0;
+                    if (enif_is_identical(tuple[1], a_per_scheduler)) {
+                        // Matches run on the dirty CPU schedulers if they
+                        // are online, on the normal ones otherwise
+                        ErlNifSysInfo si;
+                        enif_system_info(&si, sizeof(si));
+                        replicas = ds_flags != 0 && dirty_cpu_schedulers > 0
+                            ? dirty_cpu_schedulers
+                            : si.scheduler_threads;
+                    } else if (!enif_get_uint(env, tuple[1], &replicas)) {
+                        return false;
+                    }
+
+                    if (replicas < 1 || replicas > max_replicas)
+                        return false;
+                    opts.replicas = replicas;
+                } else if (enif_is_identical(tuple[0], a_warmup)) {
+
+                    // {warmup, [iodata()]}, checked by get_samples()
+
+                    if (!enif_is_list(env, tuple[1]))
+                        return false;
+                    opts.warmup  = true;
+                    opts.samples = tuple[1];
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+
+    // Warming up would compile a lazy regex right away
+    return !(opts.lazy && opts.warmup);
+}
+
+static ERL_NIF_TERM re2_compile_impl(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    ErlNifBinary pdata;
+
+    if (enif_inspect_iolist_as_binary(env, argv[0], &pdata)) {
+        const re2::StringPiece p((const char*)pdata.data, pdata.size);
+
+        compileoptions opts;
+        if (argc == 2 && !parse_compile_options(env, argv[1], opts))
+            return enif_make_badarg(env);
+
+        std::vector<re2::StringPiece> samples;
+        if (opts.warmup && !get_samples(env, opts.samples, samples))
+            return enif_make_badarg(env);
+
+        re2_handle* handle = alloc_handle(opts);
+        if (handle == nullptr)
+            return error(env, a_err_enif_alloc_resource);
+
+        parse_literal(p, opts.re2opts, handle->literal);
+        handle->pattern.assign(p.data(), p.size());
+        if (!opts.lazy) {
+            if (!compile_handle(handle, p)) {
+                enif_release_resource(handle);
+                return error(env, a_err_enif_alloc);
+            }
+
+            if (!handle->re.load()->ok()) {
+                ERL_NIF_TERM error = re2error(env, *(handle->re.load()));
+                enif_release_resource(handle);
+                return error;
+            }
+
+            if (opts.warmup && !warmup_handle(handle, samples)) {
+                enif_release_resource(handle);
+                return error(env, a_err_enif_alloc);
+            }
+        }
+
+        ERL_NIF_TERM result = enif_make_resource(env, handle);
         enif_release_resource(handle);
         return enif_make_tuple2(env, a_ok, result);
     } else {
@@ -442,11 +1898,600 @@ static ERL_NIF_TERM re2_compile_impl(
     }
 }
 
+// ================
+// re2:compile_many
+// ================
+
+// Shared state of the threads compiling one re2:compile_many batch, the
+// calling thread and any pool threads that join in. They claim patterns by
+// bumping next and store the RE2 object in the matching handle. Terms are
+// only built by the calling thread.
+struct compile_many_job
+{
+    const re2::StringPiece* patterns;
+    re2_handle** handles;
+    size_t n;
+    std::atomic<size_t> next;
+    // {warmup, Samples} for every regex, if given
+    const std::vector<re2::StringPiece>* samples;
+    // Pool threads working on the job, guarded by the pool mutex
+    unsigned workers;
+};
+
+static void compile_many_work(compile_many_job* job)
+{
+    size_t i;
+    while ((i = job->next.fetch_add(1)) < job->n) {
+        re2_handle* handle = job->handles[i];
+        if (compile_handle(handle, job->patterns[i])
+            && job->samples != nullptr
+            && !warmup_handle(handle, *job->samples)) {
+            // Report the allocation failure like compile_handle() does.
+            re2::RE2* re = handle->re.exchange(nullptr);
+            cleanup_obj_ptr(re);
+        }
+    }
+}
+
+//
+// Threads shared by all re2:compile_many calls, one per core, started by
+// on_load() and stopped by on_unload(). Concurrent calls queue their
+// batches here rather than starting threads of their own.
+//
+struct compile_pool
+{
+    ErlNifMutex* mutex;  // guards all of the below
+    // Signalled when a job is queued, and when the last pool thread leaves
+    // a job
+    ErlNifCond* work;
+    ErlNifCond* done;
+    std::vector<ErlNifTid> tids;
+    std::vector<compile_many_job*> jobs;
+    bool stop;
+
+    compile_pool()
+    : mutex(nullptr)
+    , work(nullptr)
+    , done(nullptr)
+    , stop(false)
+    {}
+};
+
+static compile_pool* compile_pool_state = nullptr;
+
+static void* compile_pool_loop(void* arg)
+{
+    compile_pool* p = (compile_pool*)arg;
+
+    enif_mutex_lock(p->mutex);
+    for (;;) {
+        while (!p->stop && p->jobs.empty())
+            enif_cond_wait(p->work, p->mutex);
+        if (p->stop)
+            break;
+
+        compile_many_job* job = p->jobs.front();
+        if (job->next.load() >= job->n) {
+            // All claimed, the caller waits for the threads still on it
+            p->jobs.erase(p->jobs.begin());
+            continue;
+        }
+        job->workers++;
+        enif_mutex_unlock(p->mutex);
+
+        compile_many_work(job);
+
+        enif_mutex_lock(p->mutex);
+        if (--job->workers == 0)
+            enif_cond_broadcast(p->done);
+    }
+    enif_mutex_unlock(p->mutex);
+    return nullptr;
+}
+
+static void start_compile_pool()
+{
+    void* mem = enif_alloc(sizeof(compile_pool));
+    if (mem == nullptr)
+        return;
+    compile_pool* p = new (mem) compile_pool();  // placement new
+
+    static char name[] = "re2_compile_many";
+    p->mutex           = enif_mutex_create(name);
+    p->work            = enif_cond_create(name);
+    p->done            = enif_cond_create(name);
+    if (p->mutex != nullptr && p->work != nullptr && p->done != nullptr) {
+        const unsigned ncores = std::thread::hardware_concurrency();
+        for (unsigned i = 0; i < ncores; i++) {
+            ErlNifTid tid;
+            if (enif_thread_create(name, &tid, &compile_pool_loop, p, nullptr)
+                != 0) {
+                DBG("enif_thread_create failed, using " << i << " threads\n");
+                break;
+            }
+            p->tids.push_back(tid);
+        }
+    }
+    if (!p->tids.empty()) {
+        compile_pool_state = p;
+        return;
+    }
+
+    // Without threads every batch is compiled by its caller
+    if (p->done != nullptr)
+        enif_cond_destroy(p->done);
+    if (p->work != nullptr)
+        enif_cond_destroy(p->work);
+    if (p->mutex != nullptr)
+        enif_mutex_destroy(p->mutex);
+    p->~compile_pool();
+    enif_free(p);
+}
+
+static void stop_compile_pool()
+{
+    compile_pool* p = compile_pool_state;
+    if (p == nullptr)
+        return;
+
+    enif_mutex_lock(p->mutex);
+    p->stop = true;
+    enif_cond_broadcast(p->work);
+    enif_mutex_unlock(p->mutex);
+    for (auto tid : p->tids)
+        enif_thread_join(tid, nullptr);
+    compile_pool_state = nullptr;
+
+    enif_cond_destroy(p->done);
+    enif_cond_destroy(p->work);
+    enif_mutex_destroy(p->mutex);
+    p->~compile_pool();
+    enif_free(p);
+}
+
+// Fewest patterns worth waking a pool thread for, as most compile in
+// microseconds. Smaller batches are compiled by the calling thread alone.
+static const size_t compile_many_per_thread = 8;
+
+static void compile_many_run(compile_many_job& job)
+{
+    compile_pool* p = compile_pool_state;
+    // The calling thread is a worker as well
+    size_t helpers = job.n / compile_many_per_thread;
+    if (helpers > 0)
+        helpers--;
+    if (p == nullptr || helpers == 0) {
+        compile_many_work(&job);
+        return;
+    }
+
+    enif_mutex_lock(p->mutex);
+    p->jobs.push_back(&job);
+    for (size_t i = 0; i < helpers && i < p->tids.size(); i++)
+        enif_cond_signal(p->work);
+    enif_mutex_unlock(p->mutex);
+
+    compile_many_work(&job);
+
+    // No thread takes the job up once it's off the queue
+    enif_mutex_lock(p->mutex);
+    auto it = std::find(p->jobs.begin(), p->jobs.end(), &job);
+    if (it != p->jobs.end())
+        p->jobs.erase(it);
+    while (job.workers > 0)
+        enif_cond_wait(p->done, p->mutex);
+    enif_mutex_unlock(p->mutex);
+}
+
+static ERL_NIF_TERM re2_compile_many_impl(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    unsigned n;
+    if (!enif_get_list_length(env, argv[0], &n))
+        return enif_make_badarg(env);
+
+    compileoptions opts;
+    if (argc == 2 && !parse_compile_options(env, argv[1], opts))
+        return enif_make_badarg(env);
+
+    std::vector<re2::StringPiece> samples;
+    if (opts.warmup && !get_samples(env, opts.samples, samples))
+        return enif_make_badarg(env);
+
+    std::vector<re2::StringPiece> patterns;
+    patterns.reserve(n);
+
+    ERL_NIF_TERM L, H, T;
+    for (L = argv[0]; enif_get_list_cell(env, L, &H, &T); L = T) {
+        ErlNifBinary pdata;
+        if (!enif_inspect_iolist_as_binary(env, H, &pdata))
+            return enif_make_badarg(env);
+        patterns.push_back(
+            re2::StringPiece((const char*)pdata.data, pdata.size));
+    }
+
+    std::vector<re2_handle*> handles(n, nullptr);
+    for (unsigned i = 0; i < n; i++) {
+        handles[i] = alloc_handle(opts);
+        if (handles[i] == nullptr) {
+            for (unsigned j = 0; j < i; j++)
+                enif_release_resource(handles[j]);
+            return error(env, a_err_enif_alloc_resource);
+        }
+        parse_literal(patterns[i], opts.re2opts, handles[i]->literal);
+        handles[i]->pattern.assign(patterns[i].data(), patterns[i].size());
+    }
+
+    if (!opts.lazy && n > 0) {
+        compile_many_job job;
+        job.patterns = patterns.data();
+        job.handles  = handles.data();
+        job.n        = n;
+        job.next     = 0;
+        job.samples  = opts.warmup ? &samples : nullptr;
+        job.workers  = 0;
+        compile_many_run(job);
+    }
+
+    std::vector<ERL_NIF_TERM> results(n);
+    for (unsigned i = 0; i < n; i++) {
+        re2_handle* handle = handles[i];
+        {
+            // Warmup may have set off a resize
+            handle_guard guard(handle);
+            re2::RE2* re = handle->re.load();
+
+            if (opts.lazy)
+                results[i] = enif_make_tuple2(
+                    env, a_ok, enif_make_resource(env, handle));
+            else if (re == nullptr)
+                results[i] = error(env, a_err_enif_alloc);
+            else if (!re->ok())
+                results[i] = re2error(env, *re);
+            else
+                results[i] = enif_make_tuple2(
+                    env, a_ok, enif_make_resource(env, handle));
+        }
+
+        enif_release_resource(handle);
+    }
+
+    return enif_make_list_from_array(env, results.data(), n);
+}
+
+// ============
+// re2:slow_log
+// ============
+
+//
+// Calls to re2:match and re2:replace slower than slow_log_threshold
+// microseconds are kept in a small ring buffer. A writer takes a ticket and
+// owns slot ticket % slow_log_size while its seq is odd. It gives up rather
+// than wait if another writer holds the slot, and readers skip entries that
+// change while being copied, so neither side ever blocks the other.
+//
+static const size_t slow_log_size   = 64;
+static const size_t slow_log_prefix = 32;  // bytes of the pattern kept
+
+struct slow_log_entry
+{
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> ticket;
+    std::atomic<uint64_t> pattern_hash;
+    std::atomic<uint64_t> pattern_size;
+    std::atomic<uint64_t> prefix[slow_log_prefix / 8];
+    std::atomic<uint64_t> subject_size;
+    std::atomic<uint64_t> mode;
+    std::atomic<int64_t> duration;
+    std::atomic<int64_t> timestamp;
+    std::atomic<int> scheduler;
+};
+
+// Plain copy of a slow_log_entry taken by a reader
+struct slow_log_record
+{
+    uint64_t ticket;
+    uint64_t pattern_hash;
+    uint64_t pattern_size;
+    uint64_t prefix[slow_log_prefix / 8];
+    uint64_t subject_size;
+    uint64_t mode;
+    int64_t duration;
+    int64_t timestamp;
+    int scheduler;
+};
+
+static slow_log_entry slow_log[slow_log_size];
+static std::atomic<uint64_t> slow_log_next(0);
+// In microseconds, negative when logging is off
+static std::atomic<ErlNifTime> slow_log_threshold(10000);
+
+//
+// The mode of a logged call: what was called and how results were asked
+// for, packed in one word
+//
+enum slow_call
+{
+    SC_MATCH   = 1,
+    SC_REPLACE = 2
+};
+
+static uint64_t slow_call_mode(const matchoptions& opts)
+{
+    return SC_MATCH | (uint64_t)opts.vs << 8 | (uint64_t)opts.ct << 16;
+}
+
+static uint64_t slow_call_mode(const replaceoptions& opts)
+{
+    return SC_REPLACE | (uint64_t)opts.global << 8;
+}
+
+static int scheduler_type()
+{
+#ifdef ERL_NIF_THR_NORMAL_SCHEDULER
+    return enif_thread_type();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t fnv1a(const re2::StringPiece& s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void slow_log_add(
+    const re2::StringPiece& pattern,
+    size_t subject_size,
+    uint64_t mode,
+    ErlNifTime start,
+    ErlNifTime duration)
+{
+    const uint64_t ticket = slow_log_next.fetch_add(1);
+    slow_log_entry& e     = slow_log[ticket % slow_log_size];
+
+    uint64_t seq = e.seq.load(std::memory_order_relaxed);
+    if ((seq & 1)
+        || !e.seq.compare_exchange_strong(
+            seq, seq + 1, std::memory_order_relaxed))
+        return;  // another writer owns the slot, drop this entry
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t prefix[slow_log_prefix / 8] = {0};
+    memcpy(prefix, pattern.data(), std::min(pattern.size(), sizeof(prefix)));
+
+    const auto relaxed = std::memory_order_relaxed;
+    e.ticket.store(ticket, relaxed);
+    e.pattern_hash.store(fnv1a(pattern), relaxed);
+    e.pattern_size.store(pattern.size(), relaxed);
+    for (size_t i = 0; i < slow_log_prefix / 8; i++)
+        e.prefix[i].store(prefix[i], relaxed);
+    e.subject_size.store(subject_size, relaxed);
+    e.mode.store(mode, relaxed);
+    e.duration.store(duration, relaxed);
+    e.timestamp.store(start + enif_time_offset(ERL_NIF_USEC), relaxed);
+    e.scheduler.store(scheduler_type(), relaxed);
+
+    e.seq.store(seq + 2, std::memory_order_release);
+}
+
+//
+// Copy an entry, returns false if it's unused or was being written
+//
+static bool slow_log_read(const slow_log_entry& e, slow_log_record& r)
+{
+    const uint64_t seq = e.seq.load(std::memory_order_acquire);
+    if (seq == 0 || (seq & 1))
+        return false;
+
+    const auto relaxed = std::memory_order_relaxed;
+    r.ticket           = e.ticket.load(relaxed);
+    r.pattern_hash     = e.pattern_hash.load(relaxed);
+    r.pattern_size     = e.pattern_size.load(relaxed);
+    for (size_t i = 0; i < slow_log_prefix / 8; i++)
+        r.prefix[i] = e.prefix[i].load(relaxed);
+    r.subject_size = e.subject_size.load(relaxed);
+    r.mode         = e.mode.load(relaxed);
+    r.duration     = e.duration.load(relaxed);
+    r.timestamp    = e.timestamp.load(relaxed);
+    r.scheduler    = e.scheduler.load(relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(relaxed) == seq;
+}
+
+//
+// Times a re2:match or re2:replace call and logs it when it goes out of
+// scope if it was slow. Calls that fail before pattern is set, e.g. on
+// badarg, are not logged. pattern must stay valid until then.
+//
+struct slow_call_timer
+{
+    re2::StringPiece pattern;
+    size_t subject_size;
+    uint64_t mode;
+    ErlNifTime start;
+
+    slow_call_timer()
+    : subject_size(0)
+    , mode(0)
+    , start(-1)
+    {
+        if (slow_log_threshold.load(std::memory_order_relaxed) >= 0)
+            start = enif_monotonic_time(ERL_NIF_USEC);
+    }
+
+    ~slow_call_timer()
+    {
+        if (start < 0 || pattern.data() == nullptr)
+            return;
+        const ErlNifTime threshold
+            = slow_log_threshold.load(std::memory_order_relaxed);
+        const ErlNifTime duration = enif_monotonic_time(ERL_NIF_USEC) - start;
+        if (threshold >= 0 && duration >= threshold)
+            slow_log_add(pattern, subject_size, mode, start, duration);
+    }
+};
+
+static ERL_NIF_TERM value_spec_term(matchoptions::value_spec vs)
+{
+    switch (vs) {
+    case matchoptions::VS_ALL:
+        return a_all;
+    case matchoptions::VS_ALL_BUT_FIRST:
+        return a_all_but_first;
+    case matchoptions::VS_FIRST:
+        return a_first;
+    case matchoptions::VS_NONE:
+        return a_none;
+    case matchoptions::VS_ALL_NAMES:
+        return a_all_names;
+    default:
+        return a_list;
+    }
+}
+
+static ERL_NIF_TERM capture_type_term(matchoptions::capture_type ct)
+{
+    switch (ct) {
+    case matchoptions::CT_BINARY:
+        return a_binary;
+    case matchoptions::CT_MAP:
+        return a_map;
+    case matchoptions::CT_CHAR_INDEX:
+        return a_char_index;
+    default:
+        return a_index;
+    }
+}
+
+static ERL_NIF_TERM scheduler_type_term(int type)
+{
+    switch (type) {
+#ifdef ERL_NIF_THR_NORMAL_SCHEDULER
+    case ERL_NIF_THR_NORMAL_SCHEDULER:
+        return a_normal;
+    case ERL_NIF_THR_DIRTY_CPU_SCHEDULER:
+        return a_dirty_cpu;
+    case ERL_NIF_THR_DIRTY_IO_SCHEDULER:
+        return a_dirty_io;
+#endif
+    default:
+        return a_undefined;
+    }
+}
+
+//
+// #{call => match | replace, capture => {ValueSpec, Type} (match),
+//   global => boolean() (replace), pattern_hash, pattern_prefix,
+//   pattern_size, subject_size, duration, scheduler, timestamp}
+//
+static ERL_NIF_TERM slow_log_record_term(
+    ErlNifEnv* env, const slow_log_record& r)
+{
+    const size_t nkeys = 9;
+    ERL_NIF_TERM keys[nkeys];
+    ERL_NIF_TERM values[nkeys];
+
+    keys[0] = a_call;
+    if ((r.mode & 0xff) == SC_MATCH) {
+        const auto vs = (matchoptions::value_spec)(r.mode >> 8 & 0xff);
+        const auto ct = (matchoptions::capture_type)(r.mode >> 16 & 0xff);
+        values[0]     = a_match;
+        keys[1]       = a_capture;
+        values[1]     = enif_make_tuple2(
+            env, value_spec_term(vs), capture_type_term(ct));
+    } else {
+        values[0] = a_replace;
+        keys[1]   = a_global;
+        values[1] = (r.mode >> 8 & 1) ? a_true : a_false;
+    }
+
+    const size_t prefix_size
+        = std::min<uint64_t>(r.pattern_size, slow_log_prefix);
+    keys[2] = a_pattern_prefix;
+    unsigned char* data = enif_make_new_binary(env, prefix_size, &values[2]);
+    if (data == nullptr)
+        return a_err_enif_alloc_binary;
+    memcpy(data, r.prefix, prefix_size);
+
+    keys[3]   = a_pattern_hash;
+    values[3] = enif_make_uint64(env, r.pattern_hash);
+    keys[4]   = a_pattern_size;
+    values[4] = enif_make_uint64(env, r.pattern_size);
+    keys[5]   = a_subject_size;
+    values[5] = enif_make_uint64(env, r.subject_size);
+    keys[6]   = a_duration;
+    values[6] = enif_make_int64(env, r.duration);
+    keys[7]   = a_scheduler;
+    values[7] = scheduler_type_term(r.scheduler);
+    keys[8]   = a_timestamp;
+    values[8] = enif_make_int64(env, r.timestamp);
+
+    ERL_NIF_TERM map;
+#ifdef RE2_HAVE_MAP_FROM_ARRAYS
+    enif_make_map_from_arrays(env, keys, values, nkeys, &map);
+#else
+    map = enif_make_new_map(env);
+    for (size_t i = 0; i < nkeys; i++)
+        enif_make_map_put(env, map, keys[i], values[i], &map);
+#endif
+    return map;
+}
+
+//
+// Logged calls, newest first
+//
+static ERL_NIF_TERM re2_slow_log(
+    ErlNifEnv* env, int, const ERL_NIF_TERM[])
+{
+    const uint64_t next = slow_log_next.load(std::memory_order_acquire);
+    const uint64_t n    = std::min<uint64_t>(next, slow_log_size);
+    std::vector<ERL_NIF_TERM> records;
+    records.reserve(n);
+
+    for (uint64_t i = 1; i <= n; i++) {
+        const uint64_t ticket = next - i;
+        slow_log_record r;
+        if (!slow_log_read(slow_log[ticket % slow_log_size], r)
+            || r.ticket != ticket)
+            continue;  // dropped, being written or already overwritten
+        ERL_NIF_TERM term = slow_log_record_term(env, r);
+        if (enif_is_identical(term, a_err_enif_alloc_binary))
+            return error(env, a_err_enif_alloc_binary);
+        records.push_back(term);
+    }
+
+    return enif_make_list_from_array(env, records.data(), records.size());
+}
+
+//
+// Threshold = non_neg_integer() (microseconds) | infinity
+//
+static ERL_NIF_TERM re2_set_slow_log_threshold(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    ErlNifSInt64 threshold;
+
+    if (enif_is_identical(argv[0], a_infinity))
+        threshold = -1;
+    else if (!enif_get_int64(env, argv[0], &threshold) || threshold < 0)
+        return enif_make_badarg(env);
+
+    slow_log_threshold.store(threshold);
+    return a_ok;
+}
+
 // =========
 // re2:match
 // =========
 
-static void parse_match_capture_options(
+static bool parse_match_capture_options(
     ErlNifEnv* env,
     matchoptions& opts,
     const ERL_NIF_TERM* tuple,
@@ -455,7 +2500,7 @@ static void parse_match_capture_options(
     bool vs_set = false;
     if (enif_is_atom(env, tuple[1])) {
 
-        // ValueSpec = all | all_but_first | first | none
+        // ValueSpec = all | all_but_first | first | none | all_names
 
         if (enif_is_atom(env, tuple[1]) > 0) {
 
@@ -467,6 +2512,8 @@ static void parse_match_capture_options(
                 opts.vs = matchoptions::VS_FIRST;
             else if (enif_is_identical(tuple[1], a_none))
                 opts.vs = matchoptions::VS_NONE;
+            else if (enif_is_identical(tuple[1], a_all_names))
+                opts.vs = matchoptions::VS_ALL_NAMES;
 
             vs_set = true;
         }
@@ -481,23 +2528,72 @@ static void parse_match_capture_options(
         opts.vs    = matchoptions::VS_VLIST;
     }
 
-    // Type = index | binary
+    // Type = index | char_index | binary | map
 
     if (tuplearity == 3 && vs_set) {
 
         if (enif_is_identical(tuple[2], a_index))
             opts.ct = matchoptions::CT_INDEX;
+        else if (enif_is_identical(tuple[2], a_char_index))
+            opts.ct = matchoptions::CT_CHAR_INDEX;
         else if (enif_is_identical(tuple[2], a_binary))
             opts.ct = matchoptions::CT_BINARY;
+        else if (enif_is_identical(tuple[2], a_map)) {
+            // A map needs names for keys
+            if (opts.vs != matchoptions::VS_ALL_NAMES)
+                return false;
+            opts.ct = matchoptions::CT_MAP;
+        }
     }
+
+    return true;
+}
+
+static bool get_size(ErlNifEnv* env, const ERL_NIF_TERM term, size_t* size)
+{
+    ErlNifUInt64 value;
+    if (!enif_get_uint64(env, term, &value))
+        return false;
+    // Past the end of any subject on 32-bit systems
+    *size = value > SIZE_MAX ? SIZE_MAX : (size_t)value;
+    return true;
+}
+
+static bool is_window_option(const ERL_NIF_TERM name)
+{
+    return enif_is_identical(name, a_offset)
+        || enif_is_identical(name, a_limit)
+        || enif_is_identical(name, a_anchor);
+}
+
+//
+// {offset, non_neg_integer()} | {limit, non_neg_integer()}
+// | {anchor, start | both}
+//
+static bool parse_window_option(
+    ErlNifEnv* env, const ERL_NIF_TERM* tuple, matchoptions& opts)
+{
+    if (enif_is_identical(tuple[0], a_offset))
+        return get_size(env, tuple[1], &opts.offset);
+    if (enif_is_identical(tuple[0], a_limit))
+        return get_size(env, tuple[1], &opts.limit);
+
+    if (enif_is_identical(tuple[1], a_start))
+        opts.anchor = re2::RE2::ANCHOR_START;
+    else if (enif_is_identical(tuple[1], a_both))
+        opts.anchor = re2::RE2::ANCHOR_BOTH;
+    else
+        return false;
+    return true;
 }
 
 //
 // Options = [ Option ]
-// Option = caseless | {offset, non_neg_integer()}
+// Option = caseless | latin1 | never_capture | {offset, non_neg_integer()}
+//          | {limit, non_neg_integer()} | {anchor, start | both}
 //          | {capture,ValueSpec} | {capture,ValueSpec,Type}
-// Type = index | binary
-// ValueSpec = all | all_but_first | first | none | ValueList
+// Type = index | char_index | binary | map
+// ValueSpec = all | all_but_first | first | none | all_names | ValueList
 // ValueList = [ ValueID ]
 // ValueID = int() | string() | atom()
 //
@@ -512,32 +2608,28 @@ static bool parse_match_options(
     for (L = list; enif_get_list_cell(env, L, &H, &T); L = T) {
         const ERL_NIF_TERM* tuple;
         int tuplearity = -1;
+        unsigned flag;
 
-        if (enif_is_identical(H, a_caseless)) {
+        if (get_variant_option(H, &flag)) {
 
-            // caseless
+            // caseless | latin1 | never_capture
 
-            opts.caseless = true;
+            opts.variant |= flag;
         } else if (enif_get_tuple(env, H, &tuplearity, &tuple)) {
 
             if (tuplearity == 2 || tuplearity == 3) {
 
-                // {offset,N} or {capture,ValueSpec}
-
-                if (enif_is_identical(tuple[0], a_offset)) {
-
-                    // {offset, int()}
+                // {offset,N}, {limit,N}, {anchor,A} or {capture,ValueSpec}
 
-                    int offset = 0;
-                    if (enif_get_int(env, tuple[1], &offset)) {
-                        opts.offset = offset;
-                    } else {
+                if (tuplearity == 2 && is_window_option(tuple[0])) {
+                    if (!parse_window_option(env, tuple, opts))
                         return false;
-                    }
                 } else if (enif_is_identical(tuple[0], a_capture)) {
 
                     // {capture,ValueSpec,Type}
-                    parse_match_capture_options(env, opts, tuple, tuplearity);
+                    if (!parse_match_capture_options(
+                            env, opts, tuple, tuplearity))
+                        return false;
                 }
             }
         } else {
@@ -548,6 +2640,94 @@ static bool parse_match_options(
     return true;
 }
 
+//
+// Number of UTF-8 characters in [p, p + len), which is the number of bytes
+// that are not continuation bytes (10xxxxxx). Each character is counted at
+// its lead byte, so a malformed sequence still counts every stray byte.
+//
+static size_t count_utf8_chars(const char* p, size_t len)
+{
+    size_t count = 0;
+    size_t i     = 0;
+#ifdef RE2_HAVE_SSE2
+    // Continuation bytes are the signed bytes below -64. The compare gives
+    // -1 per continuation byte, summed per lane in acc and folded into
+    // count before any lane can overflow.
+    const __m128i limit = _mm_set1_epi8(-64);
+    const __m128i zero  = _mm_setzero_si128();
+    while (len - i >= 16) {
+        __m128i acc = zero;
+        size_t rounds = std::min<size_t>((len - i) / 16, 255);
+        for (size_t r = 0; r < rounds; r++, i += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            acc             = _mm_sub_epi8(acc, _mm_cmplt_epi8(v, limit));
+        }
+        const __m128i sums = _mm_sad_epu8(acc, zero);
+        const size_t cont  = (size_t)_mm_cvtsi128_si32(sums)
+                          + (size_t)_mm_extract_epi16(sums, 4);
+        count += rounds * 16 - cont;
+    }
+#endif
+    for (; i < len; i++)
+        count += (signed char)p[i] >= -64;
+    return count;
+}
+
+//
+// Translates the byte offsets of a match into character offsets for
+// {capture, _, char_index}. Only the group boundaries are looked up, so the
+// subject is scanned once from its start to the end of the match and no
+// further.
+//
+struct char_index
+{
+    bool utf8;
+    // Sorted group boundaries and the characters before each of them
+    std::vector<size_t> bytes;
+    std::vector<size_t> chars;
+
+    char_index()
+    : utf8(false)
+    {}
+
+    void build(
+        const re2::StringPiece& s,
+        const std::vector<re2::StringPiece>& group,
+        int n,
+        bool is_utf8)
+    {
+        utf8 = is_utf8;
+        if (!utf8)
+            return;
+
+        for (int i = 0; i < n; i++) {
+            if (group[i].empty())
+                continue;
+            const size_t start = group[i].data() - s.data();
+            bytes.push_back(start);
+            bytes.push_back(start + group[i].size());
+        }
+        std::sort(bytes.begin(), bytes.end());
+        bytes.erase(std::unique(bytes.begin(), bytes.end()), bytes.end());
+
+        chars.reserve(bytes.size());
+        size_t pos = 0, count = 0;
+        for (size_t b : bytes) {
+            count += count_utf8_chars(s.data() + pos, b - pos);
+            chars.push_back(count);
+            pos = b;
+        }
+    }
+
+    ErlNifSInt64 at(size_t byte) const
+    {
+        if (!utf8)
+            return byte;
+        auto it = std::lower_bound(bytes.begin(), bytes.end(), byte);
+        return chars[it - bytes.begin()];
+    }
+};
+
 //
 // build result for re2:match
 //
@@ -555,9 +2735,23 @@ static ERL_NIF_TERM mres(
     ErlNifEnv* env,
     const re2::StringPiece& str,
     const re2::StringPiece& match,
-    const matchoptions::capture_type ct)
+    const matchoptions::capture_type ct,
+    const char_index* ci)
 {
     switch (ct) {
+    case matchoptions::CT_CHAR_INDEX: {
+        ErlNifSInt64 l, r;
+        if (match.empty()) {
+            l = -1;
+            r = 0;
+        } else {
+            const size_t start = match.data() - str.data();
+            l = ci->at(start);
+            r = ci->at(start + match.size()) - l;
+        }
+        return enif_make_tuple2(
+            env, enif_make_int64(env, l), enif_make_int64(env, r));
+    }
     case matchoptions::CT_BINARY:
         ErlNifBinary bmatch;
         if (!enif_alloc_binary(match.size(), &bmatch))
@@ -566,7 +2760,8 @@ static ERL_NIF_TERM mres(
         return enif_make_binary(env, &bmatch);
     default:
     case matchoptions::CT_INDEX:
-        int l, r;
+        // 64-bit because re2:match_file subjects can exceed 2 GB
+        ErlNifSInt64 l, r;
         if (match.empty()) {
             l = -1;
             r = 0;
@@ -575,20 +2770,22 @@ static ERL_NIF_TERM mres(
             r = match.size();
         }
         return enif_make_tuple2(
-            env, enif_make_int(env, l), enif_make_int(env, r));
+            env, enif_make_int64(env, l), enif_make_int64(env, r));
     }
 }
 
 static ERL_NIF_TERM re2_match_ret_vlist(
     ErlNifEnv* env,
-    const re2::RE2& re,
+    const re2::RE2* re,
     const re2::StringPiece& s,
     const matchoptions& opts,
     std::vector<re2::StringPiece>& group,
-    int n)
+    int n,
+    const char_index* ci)
 {
     std::vector<ERL_NIF_TERM> vec;
-    const auto& nmap = re.NamedCapturingGroups();
+    static const std::map<std::string, int> no_names;
+    const auto& nmap = re ? re->NamedCapturingGroups() : no_names;
     ERL_NIF_TERM VL, VH, VT;
 
     // empty StringPiece for unfound ValueIds
@@ -605,16 +2802,16 @@ static ERL_NIF_TERM re2_match_ret_vlist(
                 const re2::StringPiece match = group[nid];
                 ERL_NIF_TERM res;
                 if (!match.empty())
-                    res = mres(env, s, group[nid], opts.ct);
+                    res = mres(env, s, group[nid], opts.ct, ci);
                 else
-                    res = mres(env, s, empty, opts.ct);
+                    res = mres(env, s, empty, opts.ct, ci);
 
                 if (enif_is_identical(res, a_err_enif_alloc_binary))
                     return error(env, a_err_enif_alloc_binary);
                 else
                     vec.push_back(res);
             } else {
-                vec.push_back(mres(env, s, empty, opts.ct));
+                vec.push_back(mres(env, s, empty, opts.ct, ci));
             }
         } else if (enif_is_atom(env, VH)) {
 
@@ -630,9 +2827,9 @@ static ERL_NIF_TERM re2_match_ret_vlist(
 
                 ERL_NIF_TERM res;
                 if (it != nmap.end())
-                    res = mres(env, s, group[it->second], opts.ct);
+                    res = mres(env, s, group[it->second], opts.ct, ci);
                 else
-                    res = mres(env, s, empty, opts.ct);
+                    res = mres(env, s, empty, opts.ct, ci);
 
                 if (enif_is_identical(res, a_err_enif_alloc_binary)) {
                     enif_free(a_id);
@@ -661,9 +2858,9 @@ static ERL_NIF_TERM re2_match_ret_vlist(
 
                 ERL_NIF_TERM res;
                 if (it != nmap.end())
-                    res = mres(env, s, group[it->second], opts.ct);
+                    res = mres(env, s, group[it->second], opts.ct, ci);
                 else
-                    res = mres(env, s, empty, opts.ct);
+                    res = mres(env, s, empty, opts.ct, ci);
 
                 if (enif_is_identical(res, a_err_enif_alloc_binary)) {
                     enif_free(str_id);
@@ -684,6 +2881,56 @@ static ERL_NIF_TERM re2_match_ret_vlist(
     return enif_make_tuple2(env, a_match, list);
 }
 
+//
+// Build {match, Values} for {capture, all_names, Type} with the values in
+// name order, or {match, #{Name => Value}} if Type is map.
+//
+static ERL_NIF_TERM re2_match_ret_names(
+    ErlNifEnv* env,
+    const re2_names& names,
+    const re2::StringPiece& s,
+    const matchoptions& opts,
+    std::vector<re2::StringPiece>& group,
+    const char_index* ci)
+{
+    const size_t count = names.names.size();
+    const matchoptions::capture_type ct
+        = opts.ct == matchoptions::CT_MAP ? matchoptions::CT_BINARY : opts.ct;
+    std::vector<ERL_NIF_TERM> values(count);
+
+    for (size_t i = 0; i < count; i++) {
+        values[i] = mres(env, s, group[names.index[i]], ct, ci);
+        if (enif_is_identical(values[i], a_err_enif_alloc_binary))
+            return error(env, a_err_enif_alloc_binary);
+    }
+
+    if (opts.ct != matchoptions::CT_MAP) {
+        ERL_NIF_TERM list
+            = enif_make_list_from_array(env, values.data(), count);
+        return enif_make_tuple2(env, a_match, list);
+    }
+
+    std::vector<ERL_NIF_TERM> keys(count);
+    for (size_t i = 0; i < count; i++) {
+        const std::string& name = names.names[i];
+        unsigned char* data
+            = enif_make_new_binary(env, name.size(), &keys[i]);
+        if (data == nullptr)
+            return error(env, a_err_enif_alloc_binary);
+        memcpy(data, name.data(), name.size());
+    }
+
+    ERL_NIF_TERM map;
+#ifdef RE2_HAVE_MAP_FROM_ARRAYS
+    enif_make_map_from_arrays(env, keys.data(), values.data(), count, &map);
+#else
+    map = enif_make_new_map(env);
+    for (size_t i = 0; i < count; i++)
+        enif_make_map_put(env, map, keys[i], values[i], &map);
+#endif
+    return enif_make_tuple2(env, a_match, map);
+}
+
 //
 // Get number of capturing groups we want to request from RE2.
 //
@@ -703,128 +2950,712 @@ static int number_of_capturing_groups(
     }
 }
 
+//
+// build result for a successful re2:match as selected by opts.vs, handle is
+// nullptr if the regex was not compiled beforehand, re is nullptr for an
+// uncompiled literal
+//
+static ERL_NIF_TERM re2_match_ret(
+    ErlNifEnv* env,
+    const re2::RE2* re,
+    re2_handle* handle,
+    const re2::StringPiece& s,
+    const matchoptions& opts,
+    std::vector<re2::StringPiece>& group,
+    int n)
+{
+    int start = 0;
+    int arrsz = n;
+
+    char_index ci;
+    if (opts.ct == matchoptions::CT_CHAR_INDEX) {
+        // An ad hoc literal has no options and is matched as UTF-8
+        const re2::RE2::Options::Encoding enc
+            = re ? re->options().encoding()
+                 : handle ? handle->re2opts.encoding()
+                          : re2::RE2::Options::EncodingUTF8;
+        ci.build(s, group, n, enc == re2::RE2::Options::EncodingUTF8);
+    }
+
+    if (opts.vs == matchoptions::VS_NONE) {
+
+        // return match atom only
+
+        return a_match;
+    } else if (opts.vs == matchoptions::VS_FIRST) {
+
+        // return first match only
+
+        ERL_NIF_TERM first = mres(env, s, group[0], opts.ct, &ci);
+        if (enif_is_identical(first, a_err_enif_alloc_binary)) {
+            return error(env, a_err_enif_alloc_binary);
+        } else {
+            return enif_make_tuple2(
+                env, a_match, enif_make_list1(env, first));
+        }
+    } else if (opts.vs == matchoptions::VS_ALL_BUT_FIRST) {
+        // skip first match
+        start = 1;
+        arrsz--;
+    } else if (opts.vs == matchoptions::VS_ALL_NAMES) {
+
+        // return named subpatterns in name order or as a map
+
+        if (handle == nullptr)
+            return re2_match_ret_names(
+                env,
+                re ? re2_names(*re) : re2_names(),
+                s,
+                opts,
+                group,
+                &ci);
+
+        const re2_names* names = handle_names(handle, *re);
+        if (names == nullptr)
+            return error(env, a_err_enif_alloc);
+        return re2_match_ret_names(env, *names, s, opts, group, &ci);
+    }
+
+    if (opts.vs == matchoptions::VS_VLIST) {
+
+        // return matched subpatterns as specified in ValueList
+
+        return re2_match_ret_vlist(env, re, s, opts, group, n, &ci);
+    } else {
+
+        // return all or all_but_first matches
+
+        ERL_NIF_TERM* arr
+            = (ERL_NIF_TERM*)enif_alloc(sizeof(ERL_NIF_TERM) * n);
+        for (int i = start, arridx = 0; i < n; i++, arridx++) {
+            ERL_NIF_TERM res = mres(env, s, group[i], opts.ct, &ci);
+            if (enif_is_identical(res, a_err_enif_alloc_binary)) {
+                enif_free(arr);
+                return error(env, a_err_enif_alloc_binary);
+            } else {
+                arr[arridx] = res;
+            }
+        }
+
+        ERL_NIF_TERM list = enif_make_list_from_array(env, arr, arrsz);
+        enif_free(arr);
+
+        return enif_make_tuple2(env, a_match, list);
+    }
+}
+
+//
+// The regex a match runs with, either taken from a compiled regex or
+// compiled from a plain regex for this call only.
+//
+struct match_regex
+{
+    re2_handle* handle;
+    // nullptr for an uncompiled literal, which has no RE2 object
+    re2::RE2* re;
+    // Owns re if it's temporary
+    Re2UniquePtr tmp;
+    // Stays valid after tmp is gone, for the slow call log
+    re2::StringPiece pattern;
+    // Set if the pattern is matched with literal_find() instead of RE2
+    const re2_literal* literal;
+    re2_literal tmp_literal;
+    // Set if re is one of the handle's variants
+    bool variant;
+    // Keeps re from being freed by a resize while it's used
+    handle_guard guard;
+
+    match_regex()
+    : handle(nullptr)
+    , re(nullptr)
+    , literal(nullptr)
+    , variant(false)
+    {}
+
+    // The handle whose cached names fit re, if any
+    re2_handle* names_handle() const { return variant ? nullptr : handle; }
+};
+
+//
+// Resolve the regex argument of re2:match and friends. On failure, false is
+// returned and err is set to the term to return.
+//
+static bool get_match_regex(
+    ErlNifEnv* env,
+    const ERL_NIF_TERM arg,
+    const matchoptions& opts,
+    match_regex& mr,
+    ERL_NIF_TERM* err)
+{
+    union re2_handle_union handle;
+    ErlNifBinary pdata;
+
+    if (enif_get_resource(env, arg, re2_resource_type, &handle.vp)) {
+        // Save existing RE2 obj for use in this function
+        const unsigned variant = handle_variant(handle.p, opts.variant);
+        mr.handle              = handle.p;
+        mr.variant             = variant != 0;
+        mr.guard.enter(handle.p);
+        mr.re = mr.variant ? handle_variant_re(handle.p, variant)
+                           : handle_re(handle.p);
+        if (mr.re == nullptr) {
+            *err = error(env, a_err_enif_alloc);
+            return false;
+        }
+        // Unlike re, the handle's copy outlives the guard
+        mr.pattern = handle.p->pattern;
+
+        // The literal was parsed with the options of the handle
+        if (!mr.variant && handle.p->literal.valid)
+            mr.literal = &handle.p->literal;
+    } else if (enif_inspect_iolist_as_binary(env, arg, &pdata)) {
+        const re2::StringPiece p((const char*)pdata.data, pdata.size);
+        re2::RE2::Options re2opts;
+        re2opts.set_log_errors(false);
+        set_variant_options(re2opts, opts.variant);
+        mr.pattern = p;
+
+        // Plain strings need neither parsing nor an RE2 object
+        if (p.size() <= max_adhoc_literal
+            && parse_literal(p, re2opts, mr.tmp_literal)) {
+            mr.literal = &mr.tmp_literal;
+            return true;
+        }
+
+        // Save temporary RE2 obj for use in this function
+        mr.re = new_re2(p, re2opts);
+        if (mr.re == nullptr) {
+            *err = error(env, a_err_enif_alloc);
+            return false;
+        }
+        // Save RE2 obj ptr for cleanup via unique_ptr
+        mr.tmp.reset(mr.re);
+    } else {
+        *err = enif_make_badarg(env);
+        return false;
+    }
+
+    if (!mr.re->ok()) {
+        *err = enif_make_badarg(env);
+        return false;
+    }
+
+    return true;
+}
+
+static int regex_groups(const match_regex& mr)
+{
+    return mr.re != nullptr ? mr.re->NumberOfCapturingGroups() : 0;
+}
+
+static size_t window_end(const matchoptions& opts, const re2::StringPiece& s)
+{
+    return std::min(opts.limit, s.size());
+}
+
+//
+// RE2::Match(), or the literal search if the pattern is a plain string, in
+// the window [opts.offset, window_end()) of s from startpos. The window is
+// matched as if it were the whole subject, like a sub binary, so ^, $ and
+// \b see its bounds. It's a view into s, hence the groups are still
+// offsets in s.
+//
+static bool regex_match(
+    const match_regex& mr,
+    const re2::StringPiece& s,
+    size_t startpos,
+    const matchoptions& opts,
+    re2::StringPiece* group,
+    int n)
+{
+    const size_t endpos = window_end(opts, s);
+    if (opts.offset > endpos || startpos > endpos)
+        return false;
+    const re2::StringPiece w = s.substr(opts.offset, endpos - opts.offset);
+    startpos -= opts.offset;
+
+    if (mr.literal == nullptr) {
+        dfa_scope scope(mr.handle);
+        return mr.re->Match(w, startpos, w.size(), opts.anchor, group, n);
+    }
+
+    const re2_literal& lit = *mr.literal;
+    const size_t m         = lit.text.size();
+    size_t pos;
+    if (opts.anchor == re2::RE2::UNANCHORED) {
+        pos = literal_find(lit, w, startpos);
+        if (pos == re2::StringPiece::npos)
+            return false;
+    } else {
+        pos = startpos;
+        if (w.size() - pos < m || !literal_at(lit, w.data() + pos)
+            || (opts.anchor == re2::RE2::ANCHOR_BOTH && w.size() - pos != m))
+            return false;
+    }
+    if (n > 0)
+        group[0] = re2::StringPiece(w.data() + pos, m);
+    return true;
+}
+
 static ERL_NIF_TERM re2_match_impl(
     ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
+    slow_call_timer timer;
     ErlNifBinary sdata;
 
     if (enif_inspect_iolist_as_binary(env, argv[0], &sdata)) {
         const re2::StringPiece s((const char*)sdata.data, sdata.size);
-        re2::RE2* re               = nullptr;
-        Re2UniquePtr re_unique_ptr = nullptr;
-        union re2_handle_union handle;
-        ErlNifBinary pdata;
 
         matchoptions opts(env);
         if (argc == 3 && !parse_match_options(env, argv[2], opts))
             return enif_make_badarg(env);
 
-        if (enif_get_resource(env, argv[1], re2_resource_type, &handle.vp)
-            && handle.p->re != nullptr) {
-            // Save existing RE2 obj for use in this function
-            re = handle.p->re;
-
-            if (opts.caseless)  // caseless allowed either in compile or match
-                return enif_make_badarg(env);
-        } else if (enif_inspect_iolist_as_binary(env, argv[1], &pdata)) {
-            const re2::StringPiece p((const char*)pdata.data, pdata.size);
-            re2::RE2::Options re2opts;
-            re2opts.set_log_errors(false);
-            if (opts.caseless)
-                re2opts.set_case_sensitive(false);
-            re2::RE2* re2 = (re2::RE2*)enif_alloc(sizeof(re2::RE2));
-            if (re2 == nullptr)
-                return error(env, a_err_enif_alloc);
-            // Save temporary RE2 obj for use in this function
-            re = new (re2) re2::RE2(p, re2opts);  // placement new
-            // Save RE2 obj ptr for cleanup via unique_ptr
-            re_unique_ptr.reset(re);
-        } else {
-            return enif_make_badarg(env);
-        }
+        match_regex mr;
+        ERL_NIF_TERM err;
+        if (!get_match_regex(env, argv[1], opts, mr, &err))
+            return err;
 
-        if (!re->ok())
-            return enif_make_badarg(env);
+        timer.pattern      = mr.pattern;
+        timer.subject_size = s.size();
+        timer.mode         = slow_call_mode(opts);
 
         // nr_groups must be the number of capturing groups + 1 because
         // group[0] will be the text matched by the entire pattern, group[1]
         // will be the first capturing group et cetera (assuming n >= 2), if
         // there are any capturing groups in the regex and opts.vs causes us to
         // request them.
-        const int nr_groups = re->NumberOfCapturingGroups() + 1;
+        const int nr_groups = regex_groups(mr) + 1;
         const int n         = number_of_capturing_groups(nr_groups, opts.vs);
         std::vector<re2::StringPiece> group;
         group.reserve(n);
 
-        if (re->Match(
-                s,
-                opts.offset,
-                s.size(),
-                re2::RE2::UNANCHORED,
-                group.data(),
-                n)) {
+        if (regex_match(mr, s, opts.offset, opts, group.data(), n)) {
 
-            int start = 0;
-            int arrsz = n;
+            return re2_match_ret(
+                env, mr.re, mr.names_handle(), s, opts, group, n);
+        } else {
+
+            return a_nomatch;
+        }
+    } else {
 
-            if (opts.vs == matchoptions::VS_NONE) {
+        return enif_make_badarg(env);
+    }
+}
 
-                // return match atom only
+// ==============
+// re2:match_file
+// ==============
 
-                return a_match;
-            } else if (opts.vs == matchoptions::VS_FIRST) {
+//
+// Options = [ Option ]
+// Option = caseless | latin1 | never_capture | global | sequential
+//          | {offset, non_neg_integer()} | {limit, non_neg_integer()}
+//          | {anchor, start | both}
+//          | {capture,ValueSpec} | {capture,ValueSpec,index}
+//
+static bool parse_match_file_options(
+    ErlNifEnv* env, const ERL_NIF_TERM list, matchfileoptions& opts)
+{
+    ERL_NIF_TERM L, H, T;
 
-                // return first match only
+    for (L = list; enif_get_list_cell(env, L, &H, &T); L = T) {
+        const ERL_NIF_TERM* tuple;
+        int tuplearity = -1;
+        unsigned flag;
 
-                ERL_NIF_TERM first = mres(env, s, group[0], opts.ct);
-                if (enif_is_identical(first, a_err_enif_alloc_binary)) {
-                    return error(env, a_err_enif_alloc_binary);
-                } else {
-                    return enif_make_tuple2(
-                        env, a_match, enif_make_list1(env, first));
-                }
-            } else if (opts.vs == matchoptions::VS_ALL_BUT_FIRST) {
-                // skip first match
-                start = 1;
-                arrsz--;
+        if (enif_is_identical(H, a_global)) {
+            opts.global = true;
+        } else if (enif_is_identical(H, a_sequential)) {
+            opts.sequential = true;
+        } else if (get_variant_option(H, &flag)) {
+            opts.mopts.variant |= flag;
+        } else if (
+            enif_get_tuple(env, H, &tuplearity, &tuple)
+            && (tuplearity == 2 || tuplearity == 3)) {
+
+            if (tuplearity == 2 && is_window_option(tuple[0])) {
+                if (!parse_window_option(env, tuple, opts.mopts))
+                    return false;
+            } else if (enif_is_identical(tuple[0], a_capture)) {
+
+                // {capture,ValueSpec,index}, the file is never copied
+
+                if (!parse_match_capture_options(
+                        env, opts.mopts, tuple, tuplearity)
+                    || opts.mopts.ct != matchoptions::CT_INDEX)
+                    return false;
+            } else {
+                return false;
             }
+        } else {
+            return false;
+        }
+    }
 
-            if (opts.vs == matchoptions::VS_VLIST) {
+    return enif_is_empty_list(env, L);
+}
 
-                // return matched subpatterns as specified in ValueList
+//
+// Length of the character at pos, used to step past an empty match the
+// way RE2::GlobalReplace() does. Invalid UTF-8, overlong forms and values
+// above U+10FFFF included, is stepped over one byte at a time. Like RE2's
+// chartorune(), surrogates are stepped over whole.
+//
+static size_t next_char_len(const re2::StringPiece& s, size_t pos, bool utf8)
+{
+    if (!utf8)
+        return 1;
 
-                return re2_match_ret_vlist(env, *re, s, opts, group, n);
-            } else {
+    const unsigned char c = s[pos];
+    size_t len;
+    if (c < 0xc2 || c > 0xf4)
+        len = 1;
+    else if (c < 0xe0)
+        len = 2;
+    else if (c < 0xf0)
+        len = 3;
+    else
+        len = 4;
+
+    if (len == 1 || pos + len > s.size())
+        return 1;
+    const unsigned char c1 = s[pos + 1];
+    if ((c == 0xe0 && c1 < 0xa0) || (c == 0xf0 && c1 < 0x90)
+        || (c == 0xf4 && c1 > 0x8f))
+        return 1;
+    for (size_t i = 1; i < len; i++)
+        if ((s[pos + i] & 0xc0) != 0x80)
+            return 1;
+    return len;
+}
 
-                // return all or all_but_first matches
-
-                ERL_NIF_TERM* arr
-                    = (ERL_NIF_TERM*)enif_alloc(sizeof(ERL_NIF_TERM) * n);
-                for (int i = start, arridx = 0; i < n; i++, arridx++) {
-                    ERL_NIF_TERM res = mres(env, s, group[i], opts.ct);
-                    if (enif_is_identical(res, a_err_enif_alloc_binary)) {
-                        enif_free(arr);
-                        return error(env, a_err_enif_alloc_binary);
-                    } else {
-                        arr[arridx] = res;
-                    }
-                }
+//
+// Run the match over the whole subject. With global, every match is
+// collected, which turns re2:match_file into grep.
+//
+static ERL_NIF_TERM match_file_scan(
+    ErlNifEnv* env,
+    const match_regex& mr,
+    const re2::StringPiece& s,
+    const matchfileoptions& opts)
+{
+    const matchoptions& mopts = opts.mopts;
+    const int nr_groups       = regex_groups(mr) + 1;
+    int n = number_of_capturing_groups(nr_groups, mopts.vs);
+    std::vector<re2::StringPiece> group(n > 0 ? n : 1);
 
-                ERL_NIF_TERM list = enif_make_list_from_array(env, arr, arrsz);
-                enif_free(arr);
+    if (!opts.global || mopts.vs == matchoptions::VS_NONE) {
+        if (!regex_match(mr, s, mopts.offset, mopts, group.data(), n))
+            return a_nomatch;
+        return re2_match_ret(
+            env, mr.re, mr.names_handle(), s, mopts, group, n);
+    }
 
-                return enif_make_tuple2(env, a_match, list);
-            }
-        } else {
+    // Only RE2 can match the empty string, a literal can't
+    const bool utf8 = mr.re == nullptr
+        || mr.re->options().encoding() == re2::RE2::Options::EncodingUTF8;
+    std::vector<ERL_NIF_TERM> matches;
+    const size_t end = window_end(mopts, s);
+    size_t pos       = mopts.offset;
 
-            return a_nomatch;
+    while (pos <= end && regex_match(mr, s, pos, mopts, group.data(), n)) {
+        ERL_NIF_TERM res
+            = re2_match_ret(env, mr.re, mr.names_handle(), s, mopts, group, n);
+        const ERL_NIF_TERM* tuple;
+        int arity;
+        if (!enif_get_tuple(env, res, &arity, &tuple)
+            || !enif_is_identical(tuple[0], a_match))
+            return res;
+        matches.push_back(tuple[1]);
+
+        pos = group[0].data() + group[0].size() - s.data();
+        if (group[0].empty()) {
+            if (pos >= end)
+                break;
+            pos += next_char_len(s, pos, utf8);
         }
-    } else {
+    }
+
+    if (matches.empty())
+        return a_nomatch;
+
+    ERL_NIF_TERM list
+        = enif_make_list_from_array(env, matches.data(), matches.size());
+    return enif_make_tuple2(env, a_match, list);
+}
+
+#ifndef _WIN32
+
+static ERL_NIF_TERM posix_error(ErlNifEnv* env, int err)
+{
+    const char* name;
+
+    switch (err) {
+    case EACCES:
+        name = "eacces";
+        break;
+    case EBADF:
+        name = "ebadf";
+        break;
+    case EINVAL:
+        name = "einval";
+        break;
+    case EIO:
+        name = "eio";
+        break;
+    case EISDIR:
+        name = "eisdir";
+        break;
+    case ELOOP:
+        name = "eloop";
+        break;
+    case EMFILE:
+        name = "emfile";
+        break;
+    case ENAMETOOLONG:
+        name = "enametoolong";
+        break;
+    case ENFILE:
+        name = "enfile";
+        break;
+    case ENODEV:
+        name = "enodev";
+        break;
+    case ENOENT:
+        name = "enoent";
+        break;
+    case ENOMEM:
+        name = "enomem";
+        break;
+    case ENOTDIR:
+        name = "enotdir";
+        break;
+    case EOVERFLOW:
+        name = "eoverflow";
+        break;
+    case EPERM:
+        name = "eperm";
+        break;
+    default:
+        name = "unknown";
+        break;
+    }
+
+    return error(env, enif_make_atom(env, name));
+}
+
+//
+// Buffer that re2:match_file reads the window of a file into, one per
+// dirty IO scheduler thread. It's kept for the next call, unless it grew
+// beyond file_buffer_keep bytes for a large file.
+//
+struct file_buffer
+{
+    char* data;
+    size_t capacity;
+};
+
+static thread_local file_buffer file_buf = {nullptr, 0};
+static const size_t file_buffer_keep = 4 << 20;
+// Largest single read, so a huge window doesn't go down in one system call
+static const size_t file_read_chunk = 8 << 20;
+
+static char* file_buffer_reserve(size_t len)
+{
+    if (file_buf.data != nullptr && len <= file_buf.capacity)
+        return file_buf.data;
+
+    char* data = (char*)enif_alloc(len > 0 ? len : 1);
+    if (data == nullptr)
+        return nullptr;
+    if (file_buf.data != nullptr)
+        enif_free(file_buf.data);
+    file_buf.data     = data;
+    file_buf.capacity = len;
+    return data;
+}
+
+static void file_buffer_trim()
+{
+    if (file_buf.capacity > file_buffer_keep) {
+        enif_free(file_buf.data);
+        file_buf.data     = nullptr;
+        file_buf.capacity = 0;
+    }
+}
+
+//
+// Read len bytes at offset into buf, in chunks. Returns 0 with *got set to
+// the number of bytes read, which is less than len if the file was
+// truncated, or the errno of a failed read.
+//
+static int file_read(
+    int fd, char* buf, uint64_t offset, size_t len, size_t* got)
+{
+    *got = 0;
+    while (*got < len) {
+        const size_t chunk = std::min(len - *got, file_read_chunk);
+        const ssize_t r    = pread(fd, buf + *got, chunk, offset + *got);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (r == 0)
+            break;
+        *got += r;
+    }
+    return 0;
+}
+
+//
+// Add base to the {Offset, Length} indexes of a match_file_scan() result,
+// which was matched on a buffer holding the file from base on. Unset
+// groups keep {-1, 0}.
+//
+static ERL_NIF_TERM rebase_indexes(
+    ErlNifEnv* env, ERL_NIF_TERM term, uint64_t base)
+{
+    const ERL_NIF_TERM* tuple;
+    int arity;
+    ErlNifSInt64 offset;
+    unsigned len;
+
+    if (enif_get_tuple(env, term, &arity, &tuple) && arity == 2) {
+        if (enif_get_int64(env, tuple[0], &offset))
+            return offset < 0
+                ? term
+                : enif_make_tuple2(
+                    env, enif_make_int64(env, offset + base), tuple[1]);
+        // {match, Captures}
+        return enif_make_tuple2(
+            env, tuple[0], rebase_indexes(env, tuple[1], base));
+    }
+
+    if (enif_get_list_length(env, term, &len) && len > 0) {
+        std::vector<ERL_NIF_TERM> items;
+        items.reserve(len);
+        ERL_NIF_TERM L, H, T;
+        for (L = term; enif_get_list_cell(env, L, &H, &T); L = T)
+            items.push_back(rebase_indexes(env, H, base));
+        return enif_make_list_from_array(env, items.data(), items.size());
+    }
+
+    return term;
+}
+
+static bool same_file_state(const struct stat& a, const struct stat& b)
+{
+    return a.st_size == b.st_size && a.st_mtime == b.st_mtime
+           && a.st_ctime == b.st_ctime
+#ifdef __linux__
+           && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec
+           && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec
+#endif
+        ;
+}
+
+static ERL_NIF_TERM re2_match_file_impl(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    ErlNifBinary fdata;
+
+    if (!enif_inspect_iolist_as_binary(env, argv[0], &fdata)
+        || memchr(fdata.data, 0, fdata.size) != nullptr)
+        return enif_make_badarg(env);
 
+    const std::string path((const char*)fdata.data, fdata.size);
+
+    matchfileoptions opts(env);
+    if (argc == 3 && !parse_match_file_options(env, argv[2], opts))
         return enif_make_badarg(env);
+
+    match_regex mr;
+    ERL_NIF_TERM err;
+    if (!get_match_regex(env, argv[1], opts.mopts, mr, &err))
+        return err;
+
+    // O_NONBLOCK keeps a FIFO from blocking the open, it's rejected below
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+        return posix_error(env, errno);
+
+    struct stat before;
+    if (fstat(fd, &before) != 0) {
+        int e = errno;
+        close(fd);
+        return posix_error(env, e);
+    }
+    if (!S_ISREG(before.st_mode)) {
+        close(fd);
+        return posix_error(env, S_ISDIR(before.st_mode) ? EISDIR : EINVAL);
+    }
+
+    // Only the window is read. Matching it on its own is the same as
+    // matching it in the whole file, see regex_match().
+    const matchoptions& mopts = opts.mopts;
+    const uint64_t size       = before.st_size;
+    const uint64_t start      = mopts.offset;
+    uint64_t end              = size;
+    if (mopts.limit != SIZE_MAX && mopts.limit < end)
+        end = mopts.limit;
+    if (start > end) {
+        close(fd);
+        return a_nomatch;
+    }
+    if (end - start > (uint64_t)PTRDIFF_MAX) {
+        close(fd);
+        return posix_error(env, EOVERFLOW);
+    }
+
+    const size_t len = end - start;
+    char* buf        = file_buffer_reserve(len);
+    if (buf == nullptr) {
+        close(fd);
+        return posix_error(env, ENOMEM);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (opts.sequential)
+        posix_fadvise(fd, start, len, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    size_t got;
+    const int e = file_read(fd, buf, start, len, &got);
+    struct stat after;
+    const bool changed = e == 0
+        && (got < len || fstat(fd, &after) != 0
+            || !same_file_state(before, after));
+    close(fd);
+
+    ERL_NIF_TERM result;
+    if (e != 0) {
+        result = posix_error(env, e);
+    } else if (changed) {
+        result = error(env, a_file_changed);
+    } else {
+        matchfileoptions wopts = opts;
+        wopts.mopts.offset     = 0;
+        wopts.mopts.limit      = SIZE_MAX;
+        result = match_file_scan(env, mr, re2::StringPiece(buf, len), wopts);
+        if (start > 0)
+            result = rebase_indexes(env, result, start);
     }
+
+    file_buffer_trim();
+    return result;
+}
+
+#else
+
+static ERL_NIF_TERM re2_match_file_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM[])
+{
+    return error(env, enif_make_atom(env, "enotsup"));
 }
 
+#endif
+
 // ===========
 // re2:replace
 // ===========
@@ -867,59 +3698,685 @@ static ERL_NIF_TERM rres(ErlNifEnv* env, const std::string& s)
 static ERL_NIF_TERM re2_replace_impl(
     ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
+    slow_call_timer timer;
     ErlNifBinary sdata, rdata;
 
     if (enif_inspect_iolist_as_binary(env, argv[0], &sdata)
         && enif_inspect_iolist_as_binary(env, argv[2], &rdata)) {
         std::string s((const char*)sdata.data, sdata.size);
         const re2::StringPiece r((const char*)rdata.data, rdata.size);
-        re2::RE2* re               = nullptr;
-        Re2UniquePtr re_unique_ptr = nullptr;
-        union re2_handle_union handle;
-        ErlNifBinary pdata;
-
-        if (enif_get_resource(env, argv[1], re2_resource_type, &handle.vp)
-            && handle.p->re != nullptr) {
-            // Save existing RE2 obj for use in this function
-            re = handle.p->re;
-        } else if (enif_inspect_iolist_as_binary(env, argv[1], &pdata)) {
-            const re2::StringPiece p((const char*)pdata.data, pdata.size);
-            re2::RE2::Options re2opts;
-            re2opts.set_log_errors(false);
-            re2::RE2* re2 = (re2::RE2*)enif_alloc(sizeof(re2::RE2));
-            if (re2 == nullptr)
-                return error(env, a_err_enif_alloc);
-            // Save temporary RE2 obj for use in this function
-            re = new (re2) re2::RE2(p, re2opts);  // placement new
-            // Save RE2 obj ptr for cleanup via unique_ptr
-            re_unique_ptr.reset(re);
-        } else {
-            return enif_make_badarg(env);
-        }
 
-        if (!re->ok())
-            return enif_make_badarg(env);
+        // The regex is resolved just like for re2:match without options
+        match_regex mr;
+        ERL_NIF_TERM err;
+        if (!get_match_regex(env, argv[1], matchoptions(env), mr, &err))
+            return err;
 
         replaceoptions opts;
         if (argc == 4 && !parse_replace_options(env, argv[3], opts))
             return enif_make_badarg(env);
 
-        if (opts.global) {
-            if (re2::RE2::GlobalReplace(&s, *re, r)) {
-                return rres(env, s);
-            } else {
-                return a_error;
+        timer.pattern      = mr.pattern;
+        timer.subject_size = s.size();
+        timer.mode         = slow_call_mode(opts);
+
+        dfa_scope scope(mr.handle);
+        bool replaced;
+        if (mr.literal != nullptr)
+            replaced = opts.global
+                ? literal_global_replace(&s, *mr.literal, r)
+                : literal_replace(&s, *mr.literal, r);
+        else
+            replaced = opts.global ? re2::RE2::GlobalReplace(&s, *mr.re, r)
+                                   : re2::RE2::Replace(&s, *mr.re, r);
+
+        if (replaced) {
+            return rres(env, s);
+        } else {
+            return a_error;
+        }
+    } else {
+        return enif_make_badarg(env);
+    }
+}
+
+// ================
+// re2:pipeline_new
+// ================
+
+//
+// Compile a plain regex of a pipeline step into a handle of its own, like
+// re2:compile/1 would
+//
+static re2_handle* pipeline_handle(const re2::StringPiece& p)
+{
+    compileoptions opts;
+    re2_handle* handle = alloc_handle(opts);
+    if (handle == nullptr)
+        return nullptr;
+
+    parse_literal(p, opts.re2opts, handle->literal);
+    handle->pattern.assign(p.data(), p.size());
+    if (!compile_handle(handle, p)) {
+        enif_release_resource(handle);
+        return nullptr;
+    }
+    return handle;
+}
+
+//
+// Step = {Regex, Rewrite} | {Regex, Rewrite, [replace_option()]}
+//
+// Returns false and sets *err if the step can't be added.
+//
+static bool parse_pipeline_step(
+    ErlNifEnv* env,
+    const ERL_NIF_TERM term,
+    re2_pipeline* pipeline,
+    ERL_NIF_TERM* err)
+{
+    const ERL_NIF_TERM* tuple;
+    int arity;
+    union re2_handle_union handle;
+    ErlNifBinary pdata, rdata;
+    replaceoptions opts;
+
+    if (!enif_get_tuple(env, term, &arity, &tuple) || arity < 2 || arity > 3
+        || !enif_inspect_iolist_as_binary(env, tuple[1], &rdata)
+        || (arity == 3 && !parse_replace_options(env, tuple[2], opts))) {
+        *err = enif_make_badarg(env);
+        return false;
+    }
+
+    if (enif_get_resource(env, tuple[0], re2_resource_type, &handle.vp)) {
+        enif_keep_resource(handle.p);
+    } else if (enif_inspect_iolist_as_binary(env, tuple[0], &pdata)) {
+        handle.p = pipeline_handle(
+            re2::StringPiece((const char*)pdata.data, pdata.size));
+        if (handle.p == nullptr) {
+            *err = error(env, a_err_enif_alloc);
+            return false;
+        }
+    } else {
+        *err = enif_make_badarg(env);
+        return false;
+    }
+
+    // The step owns the reference from here on
+    pipeline->steps.push_back(pipeline_step());
+    pipeline_step& step = pipeline->steps.back();
+    step.handle         = handle.p;
+    step.rewrite.assign((const char*)rdata.data, rdata.size);
+    step.global = opts.global;
+    step.nvec   = 1 + re2::RE2::MaxSubmatch(step.rewrite);
+
+    // A lazy regex is compiled now, so that its errors show up here
+    handle_guard guard(handle.p);
+    const re2::RE2* re = handle_re(handle.p);
+    if (re == nullptr) {
+        *err = error(env, a_err_enif_alloc);
+        return false;
+    }
+    if (!re->ok()) {
+        *err = re2error(env, *re);
+        return false;
+    }
+
+    std::string rewrite_error;
+    if (!re->CheckRewriteString(step.rewrite, &rewrite_error)) {
+        ERL_NIF_TERM msg
+            = enif_make_string(env, rewrite_error.c_str(), ERL_NIF_LATIN1);
+        *err = enif_make_tuple2(
+            env,
+            a_error,
+            enif_make_tuple3(env, a_bad_rewrite, msg, tuple[1]));
+        return false;
+    }
+
+    return true;
+}
+
+static ERL_NIF_TERM re2_pipeline_new_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    unsigned n;
+    if (!enif_get_list_length(env, argv[0], &n))
+        return enif_make_badarg(env);
+
+    void* mem = enif_alloc_resource(re2_pipeline_type, sizeof(re2_pipeline));
+    if (mem == nullptr)
+        return error(env, a_err_enif_alloc_resource);
+    re2_pipeline* pipeline = new (mem) re2_pipeline();  // placement new
+    pipeline->steps.reserve(n);
+
+    ERL_NIF_TERM L, H, T;
+    for (L = argv[0]; enif_get_list_cell(env, L, &H, &T); L = T) {
+        ERL_NIF_TERM err;
+        if (!parse_pipeline_step(env, H, pipeline, &err)) {
+            enif_release_resource(pipeline);
+            return err;
+        }
+    }
+
+    ERL_NIF_TERM result = enif_make_resource(env, pipeline);
+    enif_release_resource(pipeline);
+    return enif_make_tuple2(env, a_ok, result);
+}
+
+// ================
+// re2:pipeline_run
+// ================
+
+enum step_result
+{
+    SR_NOMATCH,
+    SR_REPLACED,
+    SR_NOMEM  // a lazy regex couldn't be allocated
+};
+
+//
+// Same as RE2::Replace() and RE2::GlobalReplace(), but the result is
+// written to out, so that a pipeline can reuse the buffers of its earlier
+// steps.
+//
+static step_result pipeline_replace(
+    const pipeline_step& step, const re2::StringPiece& in, std::string* out)
+{
+    const re2_literal* lit
+        = step.handle->literal.valid ? &step.handle->literal : nullptr;
+    handle_guard guard(step.handle);
+    const re2::RE2* re = lit ? nullptr : handle_re(step.handle);
+    if (lit == nullptr && re == nullptr)
+        return SR_NOMEM;
+
+    dfa_scope scope(step.handle);
+    re2::StringPiece vec[10];  // \0 to \9
+    const char* p       = in.data();
+    const char* end     = p + in.size();
+    const char* lastend = nullptr;
+    size_t count        = 0;
+
+    out->clear();
+    while (p <= end) {
+        if (lit != nullptr) {
+            const size_t pos = literal_find(*lit, in, p - in.data());
+            if (pos == re2::StringPiece::npos)
+                break;
+            vec[0] = re2::StringPiece(in.data() + pos, lit->text.size());
+        } else if (!re->Match(
+                       in,
+                       p - in.data(),
+                       in.size(),
+                       re2::RE2::UNANCHORED,
+                       vec,
+                       step.nvec)) {
+            break;
+        }
+
+        out->append(p, vec[0].data() - p);
+
+        if (vec[0].data() == lastend && vec[0].empty()) {
+            // Don't match the empty string right after the last match
+            if (p == end)
+                break;
+            const size_t n = next_char_len(
+                in,
+                p - in.data(),
+                re->options().encoding()
+                    == re2::RE2::Options::EncodingUTF8);
+            out->append(p, n);
+            p += n;
+            continue;
+        }
+
+        if (lit != nullptr)
+            literal_rewrite(out, step.rewrite, vec[0]);
+        else
+            re->Rewrite(out, step.rewrite, vec, step.nvec);
+        p       = vec[0].data() + vec[0].size();
+        lastend = p;
+        count++;
+
+        if (!step.global)
+            break;
+    }
+
+    if (count == 0)
+        return SR_NOMATCH;
+
+    out->append(p, end - p);
+    return SR_REPLACED;
+}
+
+static ERL_NIF_TERM re2_pipeline_run_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    ErlNifBinary sdata;
+    union re2_pipeline_union pipeline;
+
+    if (!enif_inspect_iolist_as_binary(env, argv[0], &sdata)
+        || !enif_get_resource(env, argv[1], re2_pipeline_type, &pipeline.vp))
+        return enif_make_badarg(env);
+
+    // Each step reads the output of the last step that matched and writes
+    // to the other buffer, so only the subject and the result are copied.
+    re2::StringPiece cur((const char*)sdata.data, sdata.size);
+    std::string buf[2];
+    int next = 0;
+
+    for (const auto& step : pipeline.p->steps) {
+        switch (pipeline_replace(step, cur, &buf[next])) {
+        case SR_REPLACED:
+            cur  = buf[next];
+            next = 1 - next;
+            break;
+        case SR_NOMATCH:
+            break;
+        case SR_NOMEM:
+            return error(env, a_err_enif_alloc);
+        }
+    }
+
+    ERL_NIF_TERM result;
+    unsigned char* data = enif_make_new_binary(env, cur.size(), &result);
+    if (data == nullptr)
+        return error(env, a_err_enif_alloc_binary);
+    memcpy(data, cur.data(), cur.size());
+    return result;
+}
+
+// ===========
+// re2:extract
+// ===========
+
+// Most templates cached per handle
+static const int max_cached_templates = 8;
+
+//
+// Template = text with \0 to \9, \g<N> and \g<Name> referring to groups and
+// \\ for a backslash. re is nullptr for an uncompiled literal, which has no
+// groups but \0.
+//
+static bool parse_template(
+    const re2::RE2* re,
+    const re2::StringPiece& t,
+    re2_template& tmpl,
+    std::string* err)
+{
+    const int ngroups = re ? re->NumberOfCapturingGroups() : 0;
+    const char* end   = t.data() + t.size();
+    size_t len        = 0;
+
+    tmpl.text.assign(t.data(), t.size());
+    for (const char* s = t.data(); s < end; s++) {
+        if (*s != '\\') {
+            tmpl.literal.push_back(*s);
+            len++;
+            continue;
+        }
+        s++;
+
+        int group = -1;
+        if (s < end && *s == '\\') {
+            tmpl.literal.push_back('\\');
+            len++;
+            continue;
+        } else if (s < end && *s >= '0' && *s <= '9') {
+            group = *s - '0';
+        } else if (end - s > 2 && s[0] == 'g' && s[1] == '<') {
+            const char* close = (const char*)memchr(s + 2, '>', end - s - 2);
+            if (close == nullptr) {
+                *err = "missing > in \\g<";
+                return false;
+            }
+            const std::string id(s + 2, close);
+            if (!id.empty() && id.size() <= 9
+                && id.find_first_not_of("0123456789") == std::string::npos) {
+                group = 0;
+                for (char c : id)
+                    group = group * 10 + (c - '0');
+            } else if (re != nullptr) {
+                const auto& nmap = re->NamedCapturingGroups();
+                auto it          = nmap.find(id);
+                if (it != nmap.end())
+                    group = it->second;
             }
+            if (group < 0) {
+                *err = "unknown group name: " + id;
+                return false;
+            }
+            s = close;
         } else {
-            if (re2::RE2::Replace(&s, *re, r)) {
-                return rres(env, s);
-            } else {
-                return a_error;
+            *err = "invalid escape in template";
+            return false;
+        }
+
+        if (group > ngroups) {
+            *err = "template refers to group " + std::to_string(group)
+                + ", but the regexp only has " + std::to_string(ngroups);
+            return false;
+        }
+        tmpl.pieces.push_back({len, group});
+        tmpl.nvec = std::max(tmpl.nvec, group + 1);
+        len       = 0;
+    }
+    tmpl.pieces.push_back({len, -1});
+
+    return true;
+}
+
+//
+// Look up template t in the handle's cache, or parse and add it, just like
+// handle_range(). Returns nullptr with *err set if t is invalid.
+//
+static const re2_template* handle_template(
+    re2_handle* handle,
+    const re2::RE2& re,
+    const re2::StringPiece& t,
+    re2_template& tmp,
+    std::string* err)
+{
+    re2_template* head = handle->templates.load(std::memory_order_acquire);
+    for (re2_template* r = head; r != nullptr; r = r->next)
+        if (t == r->text)
+            return r;
+
+    void* mem = nullptr;
+    if (head == nullptr || head->depth < max_cached_templates)
+        mem = enif_alloc(sizeof(re2_template));
+    if (mem == nullptr)
+        return parse_template(&re, t, tmp, err) ? &tmp : nullptr;
+
+    re2_template* fresh = new (mem) re2_template();  // placement new
+    if (!parse_template(&re, t, *fresh, err)) {
+        cleanup_obj_ptr(fresh);
+        return nullptr;
+    }
+
+    for (;;) {
+        fresh->next  = head;
+        fresh->depth = head != nullptr ? head->depth + 1 : 1;
+        if (handle->templates.compare_exchange_weak(
+                head,
+                fresh,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+            return fresh;
+
+        // Another caller got in first, it may have added t as well.
+        for (re2_template* r = head; r != nullptr; r = r->next) {
+            if (t == r->text) {
+                cleanup_obj_ptr(fresh);
+                return r;
+            }
+        }
+        if (head->depth >= max_cached_templates) {
+            tmp.text.swap(fresh->text);
+            tmp.literal.swap(fresh->literal);
+            tmp.pieces.swap(fresh->pieces);
+            tmp.nvec = fresh->nvec;
+            cleanup_obj_ptr(fresh);
+            return &tmp;
+        }
+    }
+}
+
+static size_t template_size(
+    const re2_template& tmpl, const re2::StringPiece* vec)
+{
+    size_t size = tmpl.literal.size();
+    for (const auto& piece : tmpl.pieces)
+        if (piece.group >= 0)
+            size += vec[piece.group].size();
+    return size;
+}
+
+static unsigned char* template_write(
+    const re2_template& tmpl, const re2::StringPiece* vec, unsigned char* out)
+{
+    const char* lit = tmpl.literal.data();
+    for (const auto& piece : tmpl.pieces) {
+        memcpy(out, lit, piece.len);
+        out += piece.len;
+        lit += piece.len;
+        // A group that didn't participate in the match has no data
+        const re2::StringPiece g
+            = piece.group >= 0 ? vec[piece.group] : re2::StringPiece();
+        if (!g.empty()) {
+            memcpy(out, g.data(), g.size());
+            out += g.size();
+        }
+    }
+    return out;
+}
+
+static ERL_NIF_TERM re2_extract_impl(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    ErlNifBinary sdata, tdata;
+
+    if (!enif_inspect_iolist_as_binary(env, argv[0], &sdata)
+        || !enif_inspect_iolist_as_binary(env, argv[2], &tdata))
+        return enif_make_badarg(env);
+
+    const re2::StringPiece s((const char*)sdata.data, sdata.size);
+    const re2::StringPiece t((const char*)tdata.data, tdata.size);
+
+    // The regex is resolved just like for re2:match without options
+    match_regex mr;
+    ERL_NIF_TERM err;
+    if (!get_match_regex(env, argv[1], matchoptions(env), mr, &err))
+        return err;
+
+    replaceoptions opts;
+    if (argc == 4 && !parse_replace_options(env, argv[3], opts))
+        return enif_make_badarg(env);
+
+    re2_template tmp;
+    std::string terr;
+    const re2_template* tmpl;
+    if (mr.handle != nullptr && !mr.variant)
+        tmpl = handle_template(mr.handle, *mr.re, t, tmp, &terr);
+    else
+        tmpl = parse_template(mr.re, t, tmp, &terr) ? &tmp : nullptr;
+    if (tmpl == nullptr) {
+        ERL_NIF_TERM msg
+            = enif_make_string(env, terr.c_str(), ERL_NIF_LATIN1);
+        return enif_make_tuple2(
+            env, a_error, enif_make_tuple3(env, a_bad_template, msg, argv[2]));
+    }
+
+    // The groups of every match, nvec at a time
+    dfa_scope scope(mr.handle);
+    const size_t nvec = tmpl->nvec;
+    std::vector<re2::StringPiece> vec;
+    size_t pos          = 0;
+    const char* lastend = nullptr;
+
+    while (pos <= s.size()) {
+        const size_t base = vec.size();
+        vec.resize(base + nvec);
+        bool found;
+        if (mr.literal != nullptr) {
+            const size_t at = literal_find(*mr.literal, s, pos);
+            found           = at != re2::StringPiece::npos;
+            if (found)
+                vec[base] = s.substr(at, mr.literal->text.size());
+        } else {
+            found = mr.re->Match(
+                s, pos, s.size(), re2::RE2::UNANCHORED, &vec[base], nvec);
+        }
+        if (!found) {
+            vec.resize(base);
+            break;
+        }
+
+        const re2::StringPiece& m = vec[base];
+        if (m.data() == lastend && m.empty()) {
+            // Don't match the empty string right after the last match
+            vec.resize(base);
+            if (pos == s.size())
+                break;
+            pos += next_char_len(
+                s,
+                pos,
+                mr.re->options().encoding()
+                    == re2::RE2::Options::EncodingUTF8);
+            continue;
+        }
+
+        pos     = m.data() + m.size() - s.data();
+        lastend = m.data() + m.size();
+        if (!opts.global)
+            break;
+    }
+
+    const size_t nmatches = vec.size() / nvec;
+    if (nmatches == 0)
+        return a_nomatch;
+
+    std::vector<size_t> sizes(nmatches);
+    size_t total = 0;
+    for (size_t i = 0; i < nmatches; i++) {
+        sizes[i] = template_size(*tmpl, &vec[i * nvec]);
+        total += sizes[i];
+    }
+
+    // All results are written to one binary
+    ERL_NIF_TERM bin;
+    unsigned char* out = enif_make_new_binary(env, total, &bin);
+    if (out == nullptr)
+        return error(env, a_err_enif_alloc_binary);
+    for (size_t i = 0; i < nmatches; i++)
+        out = template_write(*tmpl, &vec[i * nvec], out);
+
+    if (!opts.global)
+        return bin;
+
+    std::vector<ERL_NIF_TERM> results(nmatches);
+    size_t offset = 0;
+    for (size_t i = 0; i < nmatches; i++) {
+        results[i] = enif_make_sub_binary(env, bin, offset, sizes[i]);
+        offset += sizes[i];
+    }
+    return enif_make_list_from_array(env, results.data(), nmatches);
+}
+
+// ========================
+// re2:possible_match_range
+// ========================
+
+// Most MaxLen values cached per handle, callers normally use just one
+static const int max_cached_ranges = 8;
+
+static void compute_range(const re2::RE2& re, int maxlen, re2_range& range)
+{
+    range.maxlen  = maxlen;
+    range.bounded = re.PossibleMatchRange(&range.min, &range.max, maxlen);
+}
+
+//
+// Look up the range for maxlen in the handle's cache, or compute and add
+// it. Concurrent callers may both compute it, only one copy is kept. If
+// the cache is full or allocation fails, the range is computed into tmp.
+//
+static const re2_range* handle_range(
+    re2_handle* handle, const re2::RE2& re, int maxlen, re2_range& tmp)
+{
+    re2_range* head = handle->ranges.load(std::memory_order_acquire);
+    for (re2_range* r = head; r != nullptr; r = r->next)
+        if (r->maxlen == maxlen)
+            return r;
+
+    if (head != nullptr && head->depth >= max_cached_ranges) {
+        compute_range(re, maxlen, tmp);
+        return &tmp;
+    }
+
+    void* mem = enif_alloc(sizeof(re2_range));
+    if (mem == nullptr) {
+        compute_range(re, maxlen, tmp);
+        return &tmp;
+    }
+    re2_range* fresh = new (mem) re2_range();  // placement new
+    compute_range(re, maxlen, *fresh);
+
+    for (;;) {
+        fresh->next  = head;
+        fresh->depth = head != nullptr ? head->depth + 1 : 1;
+        if (handle->ranges.compare_exchange_weak(
+                head,
+                fresh,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+            return fresh;
+
+        // Another caller got in first, it may have added maxlen as well.
+        for (re2_range* r = head; r != nullptr; r = r->next) {
+            if (r->maxlen == maxlen) {
+                cleanup_obj_ptr(fresh);
+                return r;
             }
         }
+        if (head->depth >= max_cached_ranges) {
+            tmp.maxlen  = fresh->maxlen;
+            tmp.bounded = fresh->bounded;
+            tmp.min.swap(fresh->min);
+            tmp.max.swap(fresh->max);
+            cleanup_obj_ptr(fresh);
+            return &tmp;
+        }
+    }
+}
+
+static ERL_NIF_TERM re2_possible_match_range_impl(
+    ErlNifEnv* env, int, const ERL_NIF_TERM argv[])
+{
+    int maxlen;
+    if (!enif_get_int(env, argv[1], &maxlen) || maxlen < 0)
+        return enif_make_badarg(env);
+
+    union re2_handle_union handle;
+    ErlNifBinary pdata;
+    re2_range tmp;
+    const re2_range* range;
+
+    if (enif_get_resource(env, argv[0], re2_resource_type, &handle.vp)) {
+        handle_guard guard(handle.p);
+        re2::RE2* re = handle_re(handle.p);
+        if (re == nullptr)
+            return error(env, a_err_enif_alloc);
+        if (!re->ok())
+            return enif_make_badarg(env);
+        range = handle_range(handle.p, *re, maxlen, tmp);
+    } else if (enif_inspect_iolist_as_binary(env, argv[0], &pdata)) {
+        const re2::StringPiece p((const char*)pdata.data, pdata.size);
+        re2::RE2::Options re2opts;
+        re2opts.set_log_errors(false);
+        Re2UniquePtr re(new_re2(p, re2opts));
+        if (re == nullptr)
+            return error(env, a_err_enif_alloc);
+        if (!re->ok())
+            return enif_make_badarg(env);
+        compute_range(*re, maxlen, tmp);
+        range = &tmp;
     } else {
         return enif_make_badarg(env);
     }
+
+    if (!range->bounded)
+        return a_unbounded;
+
+    ERL_NIF_TERM min, max;
+    unsigned char* data = enif_make_new_binary(env, range->min.size(), &min);
+    if (data == nullptr)
+        return error(env, a_err_enif_alloc_binary);
+    memcpy(data, range->min.data(), range->min.size());
+    data = enif_make_new_binary(env, range->max.size(), &max);
+    if (data == nullptr)
+        return error(env, a_err_enif_alloc_binary);
+    memcpy(data, range->max.data(), range->max.size());
+    return enif_make_tuple2(env, min, max);
 }
 
 extern "C" {
@@ -930,12 +4387,26 @@ static ERL_NIF_TERM re2_compile(
         env, "compile", ds_flags, &re2_compile_impl, argc, argv);
 }
 
+static ERL_NIF_TERM re2_compile_many(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env, "compile_many", ds_flags, &re2_compile_many_impl, argc, argv);
+}
+
 static ERL_NIF_TERM re2_match(
     ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
     return SCHEDULE_NIF(env, "match", ds_flags, &re2_match_impl, argc, argv);
 }
 
+static ERL_NIF_TERM re2_match_file(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env, "match_file", ds_io_flags, &re2_match_file_impl, argc, argv);
+}
+
 static ERL_NIF_TERM re2_replace(
     ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
@@ -943,15 +4414,73 @@ static ERL_NIF_TERM re2_replace(
         env, "replace", ds_flags, &re2_replace_impl, argc, argv);
 }
 
+static ERL_NIF_TERM re2_possible_match_range(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env,
+        "possible_match_range",
+        ds_flags,
+        &re2_possible_match_range_impl,
+        argc,
+        argv);
+}
+
+static ERL_NIF_TERM re2_warmup(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(env, "warmup", ds_flags, &re2_warmup_impl, argc, argv);
+}
+
+static ERL_NIF_TERM re2_stats(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(env, "stats", ds_flags, &re2_stats_impl, argc, argv);
+}
+
+static ERL_NIF_TERM re2_pipeline_new(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env, "pipeline_new", ds_flags, &re2_pipeline_new_impl, argc, argv);
+}
+
+static ERL_NIF_TERM re2_pipeline_run(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env, "pipeline_run", ds_flags, &re2_pipeline_run_impl, argc, argv);
+}
+
+static ERL_NIF_TERM re2_extract(
+    ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return SCHEDULE_NIF(
+        env, "extract", ds_flags, &re2_extract_impl, argc, argv);
+}
+
 static ErlNifFunc nif_funcs[] = {
     NIF_FUNC_ENTRY("compile", 1, re2_compile),
     NIF_FUNC_ENTRY("compile", 2, re2_compile),
+    NIF_FUNC_ENTRY("compile_many", 1, re2_compile_many),
+    NIF_FUNC_ENTRY("compile_many", 2, re2_compile_many),
     NIF_FUNC_ENTRY("match", 2, re2_match),
     NIF_FUNC_ENTRY("match", 3, re2_match),
     NIF_FUNC_ENTRY("run", 2, re2_match),
     NIF_FUNC_ENTRY("run", 3, re2_match),
+    NIF_FUNC_ENTRY("match_file", 2, re2_match_file),
+    NIF_FUNC_ENTRY("match_file", 3, re2_match_file),
     NIF_FUNC_ENTRY("replace", 3, re2_replace),
     NIF_FUNC_ENTRY("replace", 4, re2_replace),
+    NIF_FUNC_ENTRY("pipeline_new", 1, re2_pipeline_new),
+    NIF_FUNC_ENTRY("pipeline_run", 2, re2_pipeline_run),
+    NIF_FUNC_ENTRY("extract", 3, re2_extract),
+    NIF_FUNC_ENTRY("extract", 4, re2_extract),
+    NIF_FUNC_ENTRY("possible_match_range", 2, re2_possible_match_range),
+    NIF_FUNC_ENTRY("warmup", 2, re2_warmup),
+    NIF_FUNC_ENTRY("stats", 1, re2_stats),
+    NIF_FUNC_ENTRY("slow_log", 0, re2_slow_log),
+    NIF_FUNC_ENTRY("set_slow_log_threshold", 1, re2_set_slow_log_threshold),
 };
 
 static void re2_resource_cleanup(ErlNifEnv*, void* arg)
@@ -961,7 +4490,13 @@ static void re2_resource_cleanup(ErlNifEnv*, void* arg)
     cleanup_handle(handle);
 }
 
-static int on_load(ErlNifEnv* env, void**, ERL_NIF_TERM)
+static void re2_pipeline_cleanup(ErlNifEnv*, void* arg)
+{
+    re2_pipeline* pipeline = (re2_pipeline*)arg;
+    pipeline->~re2_pipeline();
+}
+
+static int on_load(ErlNifEnv* env, void**, ERL_NIF_TERM load_info)
 {
     ErlNifResourceFlags flags
         = (ErlNifResourceFlags)(ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER);
@@ -974,11 +4509,27 @@ static int on_load(ErlNifEnv* env, void**, ERL_NIF_TERM)
 
     re2_resource_type = rt;
 
+    rt = enif_open_resource_type(
+        env, nullptr, "re2_pipeline", &re2_pipeline_cleanup, flags, nullptr);
+
+    if (rt == nullptr)
+        return -1;
+
+    re2_pipeline_type = rt;
+
     init_atoms(env);
 
+    if (!install_dfa_hooks())
+        return -1;
+    start_compile_pool();
+
+    if (!enif_get_uint(env, load_info, &dirty_cpu_schedulers))
+        dirty_cpu_schedulers = 0;
+
     if (have_online_dirty_schedulers()) {
         DBG("dirty schedulers: online\n");
-        ds_flags = DS_MODE;
+        ds_flags    = DS_MODE;
+        ds_io_flags = DS_IO_MODE;
     } else {
         DBG("dirty schedulers: offline or unsupported\n");
     }
@@ -986,5 +4537,11 @@ static int on_load(ErlNifEnv* env, void**, ERL_NIF_TERM)
     return 0;
 }
 
-ERL_NIF_INIT(re2, nif_funcs, &on_load, nullptr, nullptr, nullptr)
+static void on_unload(ErlNifEnv*, void*)
+{
+    uninstall_dfa_hooks();
+    stop_compile_pool();
+}
+
+ERL_NIF_INIT(re2, nif_funcs, &on_load, nullptr, nullptr, &on_unload)
 }  // extern "C"
@@ -0,0 +1,7 @@
+#!/bin/sh
+set -eu
+REBAR=`sh -c "PATH=$PATH:dev which rebar3||dev/getrebar||echo false"`
+erl \
+    -pa $($REBAR as debug path --ebin) \
+    -noinput \
+    -eval "re2:bench_literal(${1:-100000}), init:stop()."
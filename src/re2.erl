@@ -10,22 +10,40 @@
 
 -export([ compile/1
         , compile/2
+        , compile_many/1
+        , compile_many/2
         , match/2
         , match/3
         , run/2
         , run/3
+        , match_file/2
+        , match_file/3
         , replace/3
         , replace/4
+        , pipeline_new/1
+        , pipeline_run/2
+        , extract/3
+        , extract/4
+        , possible_match_range/2
+        , warmup/2
+        , stats/1
+        , slow_log/0
+        , set_slow_log_threshold/1
         ]).
 
 %% Development test functions.
 -ifdef(DEV).
--export([l/1]).
+-export([l/1, bench_literal/1]).
 -endif.
 
 -export_type([ compile_option/0
              , match_option/0
+             , match_file_option/0
              , replace_option/0
+             , pipeline_step/0
+             , extract_option/0
+             , slow_log_entry/0
+             , stats/0
              ]).
 
 -on_load(load_nif/0).
@@ -43,7 +61,11 @@ load_nif() ->
                   Path ->
                       Path
               end,
-    erlang:load_nif(filename:join(PrivDir, "re2_nif"), 0).
+    %% Sizes {replicas, per_scheduler}
+    DirtyCPU = try erlang:system_info(dirty_cpu_schedulers)
+               catch error:badarg -> 0
+               end,
+    erlang:load_nif(filename:join(PrivDir, "re2_nif"), DirtyCPU).
 
 %% NOTE: compiled_regex/0 is not declared as -opaque because:
 %% 1. If you declare :: any() as an opaque type, then the compiler will
@@ -64,32 +86,109 @@ load_nif() ->
 -type regex() :: plain_regex() | compiled_regex().
 -type replacement() :: iodata().
 
--type match_option() :: 'caseless' | {'offset', non_neg_integer()}
+-type match_option() :: variant_option() | window_option()
                       | {'capture', value_spec()}
                       | {'capture', value_spec(), value_spec_type()}.
 -type value_spec() :: 'all' | 'all_but_first' | 'first' | 'none'
-                    | [value_id()].
--type value_spec_type() :: 'index' | 'binary'.
+                    | 'all_names' | [value_id()].
+-type value_spec_type() :: 'index' | 'char_index' | 'binary' | 'map'.
 -type value_id() :: non_neg_integer() | string() | atom().
 -type match_result() :: 'match' | 'nomatch' | {'match', list()}
+                      | {'match', #{binary() => binary()}}
                       | {'error', atom()}.
 
 -type compile_error_str() :: string().
 -type compile_error_arg() :: string().
 -type compile_error() :: {'error', atom()}
                        | {atom(), compile_error_str(), compile_error_arg()}.
--type compile_option() :: 'caseless' | {'max_mem', non_neg_integer()}.
+-type variant_option() :: 'caseless' | 'latin1' | 'never_capture'.
+-type window_option() :: {'offset', non_neg_integer()}
+                       | {'limit', non_neg_integer()}
+                       | {'anchor', 'start' | 'both'}.
+-type compile_option() :: variant_option() | {'max_mem', non_neg_integer()}
+                        | {'lazy', boolean()}
+                        | {'replicas', pos_integer() | 'per_scheduler'}
+                        | {'warmup', [subject()]}
+                        | {'auto_max_mem', pos_integer()}.
 -type compile_result() :: {'ok', compiled_regex()} | compile_error().
 
+-type file_path() :: iodata().
+-type match_file_option() :: variant_option() | window_option()
+                           | 'global' | 'sequential'
+                           | {'capture', value_spec()}
+                           | {'capture', value_spec(), 'index'}.
+-type match_file_result() :: match_result() | {'match', [list()]}
+                           | {'error', 'file_changed' | atom()}.
+
 -type replace_option() :: 'global'.
 -type replace_result() :: binary() | {'error', atom()} | 'error'.
 
+-type template() :: iodata().
+-type extract_option() :: 'global'.
+-type extract_result() :: binary() | [binary()] | 'nomatch'
+                        | {'error', {'bad_template', string(), template()}}
+                        | {'error', atom()}.
+
+-type pipeline() :: any().
+%% pipeline/0 is a resource just like compiled_regex/0.
+-type pipeline_step() :: {regex(), replacement()}
+                       | {regex(), replacement(), [replace_option()]}.
+-type pipeline_result() :: {'ok', pipeline()} | compile_error()
+                         | {'error', {'bad_rewrite', string(), replacement()}}.
+
+-type stats() :: #{'program_size' := non_neg_integer(),
+                   'reverse_program_size' := integer(),
+                   'replicas' := pos_integer(),
+                   'replicas_used' := non_neg_integer(),
+                   'literal' := boolean(),
+                   'warmup_samples' := non_neg_integer(),
+                   'warmup_bytes' := non_neg_integer(),
+                   'warmup_time' := non_neg_integer(),
+                   'dfa_failures' := non_neg_integer() | 'undefined',
+                   'dfa_cache_resets' := non_neg_integer() | 'undefined',
+                   'max_mem' := pos_integer()}.
+
+-type match_range() :: {binary(), binary()} | 'unbounded'
+                     | {'error', atom()}.
+
+-type slow_log_entry() ::
+        #{'call' := 'match' | 'replace',
+          'capture' => {'all' | 'all_but_first' | 'first' | 'none'
+                        | 'all_names' | 'list', value_spec_type()},
+          'global' => boolean(),
+          'pattern_hash' := non_neg_integer(),
+          'pattern_prefix' := binary(),
+          'pattern_size' := non_neg_integer(),
+          'subject_size' := non_neg_integer(),
+          'duration' := non_neg_integer(),
+          'scheduler' := 'normal' | 'dirty_cpu' | 'dirty_io' | 'undefined',
+          'timestamp' := integer()}.
+
 %% @doc Same as calling ``compile(Regex, [])''.
 -spec compile(Regex::plain_regex()) -> compile_result().
 compile(_) ->
     ?nif_stub.
 
 %% @doc Compile regex for reuse.
+%% A compiled regex can be shared by any number of processes. RE2 caches
+%% the DFA states it builds while matching behind a lock, so a regex that
+%% is hot on many schedulers at once can use ``{replicas, N}'' to keep N
+%% independent copies, one of which is picked by each native thread.
+%% ``{replicas, per_scheduler}'' uses one copy per dirty CPU scheduler,
+%% which run the matches, or per scheduler if there are none.
+%% Every copy costs the memory of a separately compiled regex.
+%% RE2 also builds its DFA states while matching, so the first matches
+%% against a fresh regex are slower. ``{warmup, Samples}'' matches the
+%% sample subjects right away on every copy, see ``warmup/2''. It cannot
+%% be combined with ``{lazy, true}''.
+%% When a match runs out of the DFA memory given by ``max_mem'', RE2
+%% falls back to a much slower matcher, which ``stats/1'' counts.
+%% ``{auto_max_mem, Ceiling}'' then recompiles the regex in the background
+%% with twice the ``max_mem'', at least RE2's default of 8 MB and at most
+%% Ceiling bytes, and swaps it in. The copies it replaces are freed once
+%% the calls still using them return. It needs the DFA hooks of the RE2
+%% library the NIF is built with, without them it raises badarg and
+%% ``stats/1'' returns ``undefined'' for the DFA counters.
 %% ```
 %% 1> {ok, RE} = re2:compile("Foo.*Bar", [caseless]).
 %% {ok,#Ref<0.3540238268.2241986568.233969>}
@@ -100,15 +199,58 @@ compile(_) ->
 compile(_,_) ->
     ?nif_stub.
 
+%% @doc Same as calling ``compile_many(Regexes, [])''.
+-spec compile_many(Regexes::[plain_regex()]) -> [compile_result()].
+compile_many(_) ->
+    ?nif_stub.
+
+%% @doc Compile a list of regexes in parallel on a pool of native
+%% threads, one per core, that all calls share. A short list is compiled
+%% by the calling scheduler alone. The result list holds the compile
+%% result of each regex in order.
+%% With ``{lazy, true}'' each regex is only compiled when it's first used,
+%% and an invalid regex is not reported until then. Matching against such
+%% a regex raises badarg just like an invalid uncompiled regex does.
+%% ```
+%% 1> re2:compile_many(["Foo.*Bar", "(Baz"], [caseless]).
+%% [{ok,#Ref<0.3540238268.2241986568.233970>},
+%%  {error,{missing_paren,"missing ): (Baz","(Baz"}}]'''
+-spec compile_many(Regexes::[plain_regex()],
+                   Options::[compile_option()]) -> [compile_result()].
+compile_many(_,_) ->
+    ?nif_stub.
+
 %% @doc Same as calling ``match(Subject, Regex, [])''.
 -spec match(Subject::subject(), Regex::regex()) -> match_result().
 match(_,_) ->
     ?nif_stub.
 
 %% @doc Execute regular expression matching on subject string.
+%% ``{capture, all_names, map}'' returns the named subpatterns as a map
+%% from name to binary, the map type is only allowed with ``all_names''.
+%% ``char_index'' returns ``{Offset, Length}'' counted in characters rather
+%% than bytes for UTF-8 regexes.
+%% ``caseless'', ``latin1'' and ``never_capture'' also work with a compiled
+%% regex. The first call that adds any of them to the options the regex was
+%% compiled with compiles a variant of it, which is kept with the regex for
+%% later calls.
+%% Only the bytes from ``{offset, Offset}'' up to ``{limit, End}'' of the
+%% subject are searched, without making a sub binary. The window is
+%% matched as if it were a sub binary, so ``^'', ``$'' and ``\b'' see its
+%% bounds, but the returned indexes are still counted from the start of
+%% the subject. ``{anchor, start}'' only matches at Offset and ``{anchor,
+%% both}'' only matches the whole window.
 %% ```
 %% 1> re2:match("Bar-foo-Baz", "FoO", [caseless]).
-%% {match,[<<"foo">>]}'''
+%% {match,[<<"foo">>]}
+%% 2> re2:match("2021-06", "(?P<y>\\d+)-(?P<m>\\d+)",
+%%              [{capture, all_names, map}]).
+%% {match,#{<<"m">> => <<"06">>,<<"y">> => <<"2021">>}}
+%% 3> re2:match(<<"h\x{e9}llo"/utf8>>, "l+", [{capture, first, char_index}]).
+%% {match,[{2,2}]}
+%% 4> re2:match("abc abc", "abc", [{offset, 1}, {limit, 7},
+%%                                 {capture, first, index}]).
+%% {match,[{4,3}]}'''
 -spec match(Subject::subject(), Regex::regex(),
             Options::[match_option()]) -> match_result().
 match(_,_,_) ->
@@ -125,6 +267,33 @@ run(_,_) ->
 run(_,_,_) ->
     ?nif_stub.
 
+%% @doc Same as calling ``match_file(Path, Regex, [])''.
+-spec match_file(Path::file_path(), Regex::regex()) -> match_file_result().
+match_file(_,_) ->
+    ?nif_stub.
+
+%% @doc Execute regular expression matching on the contents of a file.
+%% The file is read into a native buffer that's reused between calls and
+%% never copied onto the heap, hence captures are always returned as
+%% ``{Offset, Length}'' byte indexes. With ``global'' all matches are
+%% returned, one capture list per match. ``sequential'' advises the
+%% kernel that the file is read sequentially. Offset and limit work as in
+%% ``match/3'', and only the bytes between them are read, so a file larger
+%% than memory can be scanned in windows. If the file changes while it's
+%% being read, ``{error, file_changed}'' is returned, also when it's
+%% truncated. Only regular files can be scanned, for others
+%% ``{error, einval}'' is returned.
+%% On Windows ``{error, enotsup}'' is returned.
+%% ```
+%% 1> file:write_file("app.log", "ok\nERROR 1\nok\nERROR 2\n").
+%% ok
+%% 2> re2:match_file("app.log", "ERROR (\\d)", [global]).
+%% {match,[[{3,7},{9,1}],[{14,7},{20,1}]]}'''
+-spec match_file(Path::file_path(), Regex::regex(),
+                 Options::[match_file_option()]) -> match_file_result().
+match_file(_,_,_) ->
+    ?nif_stub.
+
 %% @doc Same as calling ``replace(Subject, Regex, Replacement, [])''.
 -spec replace(Subject::subject(), Regex::regex(),
               Replacement::replacement()) -> replace_result().
@@ -140,6 +309,136 @@ replace(_,_,_) ->
 replace(_,_,_,_) ->
     ?nif_stub.
 
+%% @doc Create a pipeline of replacements for ``pipeline_run/2''.
+%% Plain regexes are compiled and every Rewrite is checked against its
+%% regex here, so that running the pipeline only fails if memory for a
+%% lazily compiled regex can't be allocated.
+%% ```
+%% 1> {ok, P} = re2:pipeline_new([{"\\s+", " ", [global]},
+%%                                {"(\\w+)@(\\w+)", "\\2 at \\1"}]).
+%% {ok,#Ref<0.3540238268.2241986568.233970>}'''
+-spec pipeline_new(Steps::[pipeline_step()]) -> pipeline_result().
+pipeline_new(_) ->
+    ?nif_stub.
+
+%% @doc Apply the replacements of a pipeline in order, each one to the
+%% result of the one before it, and return the final result. A step whose
+%% regex doesn't match leaves the subject as it is. Returns
+%% ``{error, enif_alloc}'' if a lazy regex of a step, or one of its
+%% replicas, can't be allocated. This is faster than
+%% the same sequence of ``replace/4'' calls, as the intermediate results
+%% are never copied into binaries.
+%% ```
+%% 2> re2:pipeline_run("mail   bob@example now", P).
+%% <<"mail example at bob now">>'''
+-spec pipeline_run(Subject::subject(), Pipeline::pipeline())
+                  -> binary() | {'error', atom()}.
+pipeline_run(_,_) ->
+    ?nif_stub.
+
+%% @doc Same as calling ``extract(Subject, Regex, Template, [])''.
+-spec extract(Subject::subject(), Regex::regex(), Template::template())
+             -> extract_result().
+extract(_,_,_) ->
+    ?nif_stub.
+
+%% @doc Match the regex and return Template with the groups of the match
+%% filled in. In the template ``\N'' and ``\g<N>'' refer to group N,
+%% ``\g<Name>'' to a named group and ``\\'' is a backslash. With
+%% ``global'' a list with the template filled in for every match is
+%% returned. The template is resolved once per compiled regex and the
+%% results are built directly into one binary.
+%% ```
+%% 1> re2:extract("mail bob@example now", "(?P<user>\\w+)@(?P<host>\\w+)",
+%%                "\\g<host>/\\g<user>").
+%% <<"example/bob">>
+%% 2> re2:extract("a=1 b=2", "(\\w)=(\\d)", "\\2\\1", [global]).
+%% [<<"1a">>,<<"2b">>]'''
+-spec extract(Subject::subject(), Regex::regex(), Template::template(),
+              Options::[extract_option()]) -> extract_result().
+extract(_,_,_,_) ->
+    ?nif_stub.
+
+%% @doc Compute the range of strings the regex can match at their start.
+%% Every string S that the regex matches at position 0, as it does with
+%% a leading ``^'', satisfies ``Min =< S'' and ``S =< Max'' as binaries,
+%% so a scan of sorted keys can be limited to that range. Min and Max are
+%% at most MaxLen bytes long, the regex's literal prefix included.
+%% ``unbounded'' is returned when no useful range exists. The result is
+%% cached in a compiled regex for each MaxLen.
+%% ```
+%% 1> re2:possible_match_range("^key/(foo|bar)/\\d+", 10).
+%% {<<"key/bar/0">>,<<"key/foo/9:">>}
+%% 2> re2:possible_match_range("^abc", 0).
+%% unbounded'''
+-spec possible_match_range(Regex::regex(), MaxLen::non_neg_integer())
+                          -> match_range().
+possible_match_range(_,_) ->
+    ?nif_stub.
+
+%% @doc Match sample subjects against a compiled regex so that RE2 builds
+%% the DFA states they need ahead of the first real match. Each sample is
+%% matched with and without match bounds and anchored at the start, which
+%% covers the forward and the reverse program. Subjects similar to the
+%% expected input work best. Returns ``ok''.
+%% ```
+%% 1> {ok, RE} = re2:compile("(\\w+)@(\\w+)\\.com").
+%% {ok,#Ref<0.3540238268.2241986568.233971>}
+%% 2> re2:warmup(RE, ["mail joe@example.com now"]).
+%% ok'''
+-spec warmup(Regex::compiled_regex(), Samples::[subject()]) -> 'ok'.
+warmup(_,_) ->
+    ?nif_stub.
+
+%% @doc Return statistics of a compiled regex: the size of its forward and
+%% reverse programs, the number of replicas and how many of them matches
+%% have used so far, whether it's matched as a
+%% plain string without RE2, the number of samples, bytes and
+%% microseconds spent on warming it up, the number of searches that ran
+%% out of DFA memory and of DFA cache resets, and the current
+%% ``max_mem''. The DFA counters are ``undefined'' if the linked RE2
+%% doesn't report them. RE2 doesn't expose the number of DFA states it
+%% has built.
+%% ```
+%% 1> {ok, RE} = re2:compile("a+b", [{warmup, ["aaab"]}]).
+%% {ok,#Ref<0.3540238268.2241986568.233972>}
+%% 2> re2:stats(RE).
+%% #{dfa_cache_resets => 0,dfa_failures => 0,literal => false,
+%%   max_mem => 8388608,program_size => 7,replicas => 1,
+%%   replicas_used => 0,reverse_program_size => 7,warmup_bytes => 4,
+%%   warmup_samples => 1,warmup_time => 12}'''
+-spec stats(Regex::compiled_regex()) -> stats().
+stats(_) ->
+    ?nif_stub.
+
+%% @doc Return the most recent match and replace calls that took longer
+%% than the slow log threshold, newest first. At most 64 calls are kept.
+%% Each entry holds a hash and the first 32 bytes of the pattern, the
+%% subject size, how results were requested, the duration in
+%% microseconds, the type of scheduler the call ran on and the Erlang
+%% system time in microseconds when it started. Reading the log never
+%% blocks concurrent matching.
+%% ```
+%% 1> re2:set_slow_log_threshold(0).
+%% ok
+%% 2> re2:match("foo", "o+").
+%% {match,[<<"oo">>]}
+%% 3> re2:slow_log().
+%% [#{call => match,capture => {all,binary},duration => 14,
+%%    pattern_hash => 12638187200555641996,pattern_prefix => <<"o+">>,
+%%    pattern_size => 2,scheduler => dirty_cpu,subject_size => 3,
+%%    timestamp => 1634567890123456}]'''
+-spec slow_log() -> [slow_log_entry()].
+slow_log() ->
+    ?nif_stub.
+
+%% @doc Log match and replace calls that take at least Threshold
+%% microseconds, or none with ``infinity''. The default is 10000.
+-spec set_slow_log_threshold(Threshold::non_neg_integer() | 'infinity')
+                            -> 'ok'.
+set_slow_log_threshold(_) ->
+    ?nif_stub.
+
 
 %% Development test functions.
 %% @private
@@ -150,4 +449,44 @@ l(N) ->
     {match, [<<"o">>]} = re2:match("foo", "o", [{capture, first, binary}]),
     <<"f1o">> = re2:replace("foo", "o", "1"),
     l(N-1).
+
+%% Compare plain string patterns, which are searched for without RE2, with
+%% the same regex wrapped in "(?:...)", which always goes through RE2.
+%% Prints microseconds per call.
+%% @private
+bench_literal(N) ->
+    Short = <<"2021-06-01 12:00:00 host app[123]: ERROR disk full">>,
+    Line = <<"2021-06-01 12:00:00 host app[123]: INFO all good\n">>,
+    Long = <<(binary:copy(Line, 4 * 1024 * 1024 div byte_size(Line)))/binary,
+             "ERROR\n">>,
+    Runs = [{short, Short, N}, {long, Long, max(1, N div 10000)}],
+    [bench_literal(Size, Subject, Iter, Kind, Literal)
+     || {Size, Subject, Iter} <- Runs,
+        {Kind, Literal} <- [{match, "ERROR"}, {replace, "INFO"}]],
+    ok.
+
+bench_literal(Size, Subject, N, Kind, Literal) ->
+    Regex = "(?:" ++ Literal ++ ")",
+    {ok, CLiteral} = re2:compile(Literal),
+    {ok, CRegex} = re2:compile(Regex),
+    Calls = [{uncompiled, Literal, Regex}, {compiled, CLiteral, CRegex}],
+    [begin
+         TL = bench_call(Kind, Subject, L, N),
+         TR = bench_call(Kind, Subject, R, N),
+         io:format("~-6w ~-15w ~-11w literal ~10.2f  regex ~10.2f  x~.1f~n",
+                   [Size, Kind, How, TL, TR, TR / TL])
+     end || {How, L, R} <- Calls].
+
+bench_call(Kind, Subject, RE, N) ->
+    {T, ok} = timer:tc(fun() -> bench_loop(Kind, Subject, RE, N) end),
+    T / N.
+
+bench_loop(_, _, _, 0) ->
+    ok;
+bench_loop(replace, Subject, RE, N) ->
+    _ = re2:replace(Subject, RE, "-", [global]),
+    bench_loop(replace, Subject, RE, N-1);
+bench_loop(Kind, Subject, RE, N) ->
+    {match, _} = re2:match(Subject, RE, [{capture, first, index}]),
+    bench_loop(Kind, Subject, RE, N-1).
 -endif.
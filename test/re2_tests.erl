@@ -14,6 +14,90 @@ compile_test() ->
                  (catch re2:compile("test(?<name", [unknown]))),
     ?assertMatch({error,{bad_perl_op,_,_}}, re2:compile("test(?<name")).
 
+replicas_test() ->
+    {ok, RE} = re2:compile("h(e+)", [{replicas, 4}]),
+    {ok, PerSched} = re2:compile("h(e+)", [{replicas, per_scheduler}]),
+    {ok, Lazy} = re2:compile("h(e+)", [{replicas, 2}, {lazy, true}]),
+    ?assertMatch({error, {missing_paren,_,_}},
+                 re2:compile("(a", [{replicas, 2}])),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile("a", [{replicas, 0}]))),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile("a", [{replicas, many}]))),
+    Self = self(),
+    Pids = [spawn_link(fun() ->
+                               R = [{re2:match("xheey", X),
+                                     re2:replace("xheey", X, "-")}
+                                    || _ <- lists:seq(1, 100),
+                                       X <- [RE, PerSched, Lazy]],
+                               Self ! {self(), lists:usort(R)}
+                       end) || _ <- lists:seq(1, 16)],
+    [receive
+         {Pid, R} ->
+             ?assertEqual([{{match,[<<"hee">>,<<"ee">>]}, <<"x-y">>}], R)
+     end || Pid <- Pids],
+    %% As many concurrent matches as there are dirty CPU schedulers end up
+    %% using every replica
+    N = erlang:system_info(dirty_cpu_schedulers),
+    {ok, Hot} = re2:compile("(a|b)*c", [{replicas, per_scheduler}]),
+    ?assertMatch(#{replicas := N, replicas_used := 0}, re2:stats(Hot)),
+    ?assertEqual(N, replicas_used(Hot, binary:copy(<<"ab">>, 1 bsl 19), N,
+                                  20)).
+
+replicas_used(RE, _Subject, _N, 0) ->
+    maps:get(replicas_used, re2:stats(RE));
+replicas_used(RE, Subject, N, Tries) ->
+    Self = self(),
+    Pids = [spawn_link(fun() ->
+                               [nomatch = re2:match(Subject, RE)
+                                || _ <- lists:seq(1, 10)],
+                               Self ! {self(), done}
+                       end) || _ <- lists:seq(1, N)],
+    [receive {Pid, done} -> ok end || Pid <- Pids],
+    case re2:stats(RE) of
+        #{replicas_used := N} -> N;
+        _ -> replicas_used(RE, Subject, N, Tries - 1)
+    end.
+
+variants_test() ->
+    {ok, RE} = re2:compile("h(.*)o"),
+    ?assertEqual(nomatch, re2:match("HELLO", RE)),
+    ?assertEqual({match,[<<"HELLO">>,<<"ELL">>]},
+                 re2:match("HELLO", RE, [caseless])),
+    ?assertEqual({match,[<<"HELLO">>]},
+                 re2:match("HELLO", RE, [caseless, never_capture])),
+    ?assertEqual({match,[<<"hello">>,<<"ell">>]}, re2:match("hello", RE)),
+    {ok, Dot} = re2:compile("^."),
+    ?assertEqual({match,[{0,2}]},
+                 re2:match(<<"\x{e9}"/utf8>>, Dot, [{capture,all,index}])),
+    ?assertEqual({match,[{0,1}]},
+                 re2:match(<<"\x{e9}"/utf8>>, Dot,
+                           [latin1, {capture,all,index}])),
+    {ok, Latin1} = re2:compile("^.", [latin1]),
+    ?assertEqual({match,[{0,1}]},
+                 re2:match(<<"\x{e9}"/utf8>>, Latin1, [{capture,all,index}])),
+    {ok, Lazy} = re2:compile("x+", [{lazy, true}]),
+    ?assertEqual({match,[<<"XX">>]}, re2:match("aXXb", Lazy, [caseless])),
+    ?assertEqual(nomatch, re2:match("aXXb", Lazy)).
+
+compile_many_test() ->
+    ?assertEqual([], re2:compile_many([])),
+    ?assertMatch([{ok, _}, {error, {missing_paren,_,_}}, {ok, _}],
+                 re2:compile_many([".*", "(a", <<"b+">>])),
+    ?assertMatch({'EXIT',{badarg,_}}, (catch re2:compile_many(["a", 1]))),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile_many(["a"], [unknown]))),
+    Many = [integer_to_list(N) ++ "(a|b)*c" || N <- lists:seq(1, 1000)],
+    Compiled = re2:compile_many(Many),
+    ?assertEqual(1000, length([RE || {ok, RE} <- Compiled])),
+    {ok, RE1} = hd(Compiled),
+    ?assertEqual({match,[<<"1abc">>,<<"b">>]}, re2:match("x1abc", RE1)),
+    [{ok, Lazy}, {ok, LazyBad}] =
+        re2:compile_many(["h.*o", "(a"], [caseless, {lazy, true}]),
+    ?assertEqual({match,[<<"HELLO">>]}, re2:match("HELLO", Lazy)),
+    ?assertEqual(<<"-">>, re2:replace("hello", Lazy, "-")),
+    ?assertMatch({'EXIT',{badarg,_}}, (catch re2:match("a", LazyBad))).
+
 replace_test() ->
     ?assertEqual(<<"heLo worLd">>,
                  re2:replace("hello world","l+","L",[global])),
@@ -28,6 +112,288 @@ replace_test() ->
     ?assertMatch({'EXIT', {badarg,_}},
                  (catch re2:replace("hello world","l+","L",[unknown]))).
 
+extract_test() ->
+    {ok, RE} = re2:compile("(?P<user>\\w+)@(?P<host>\\w+)"),
+    ?assertEqual(<<"example/bob">>,
+                 re2:extract("mail bob@example now", RE,
+                             "\\g<host>/\\g<user>")),
+    ?assertEqual(<<"example:bob:bob@example\\">>,
+                 re2:extract("mail bob@example now", RE, "\\2:\\1:\\0\\\\")),
+    ?assertEqual([<<"ba">>, <<"dc">>],
+                 re2:extract("a@b c@d", RE, "\\2\\1", [global])),
+    ?assertEqual([<<"<foo>">>, <<"<foo>">>],
+                 re2:extract("foo foo", "foo", "<\\0>", [global])),
+    ?assertEqual(nomatch, re2:extract("nothing", RE, "x")),
+    ?assertEqual(nomatch, re2:extract("nothing", RE, "x", [global])),
+    ?assertMatch({error, {bad_template, _, "\\g<nope>"}},
+                 re2:extract("a@b", RE, "\\g<nope>")),
+    ?assertMatch({error, {bad_template, _, "\\3"}},
+                 re2:extract("a@b", RE, "\\3")),
+    ?assertMatch({'EXIT', {badarg,_}},
+                 (catch re2:extract("a@b", RE, "x", [unknown]))),
+    %% Empty matches step over invalid UTF-8 a byte at a time, as in replace
+    [?assertEqual(length(binary:matches(re2:replace(S, "x*", "-", [global]),
+                                        <<"-">>)),
+                  length(re2:extract(S, "x*", "\\0", [global])))
+     || S <- invalid_utf8()].
+
+pipeline_test() ->
+    {ok, Lit} = re2:compile("foo"),
+    {ok, P} = re2:pipeline_new([{"\\s+", " ", [global]},
+                                {"(\\w+)@(\\w+)", "\\2 at \\1"},
+                                {Lit, "[\\0]", [global]},
+                                {"zzz", "y"}]),
+    ?assertEqual(<<"a [foo] host at bob [foo]">>,
+                 re2:pipeline_run("a   foo\tbob@host  foo", P)),
+    ?assertEqual(<<>>, re2:pipeline_run("", P)),
+    ?assertEqual(re2:replace("abc", "x*", "-", [global]),
+                 re2:pipeline_run("abc",
+                                  element(2, re2:pipeline_new(
+                                               [{"x*", "-", [global]}])))),
+    ?assertMatch({error, {bad_rewrite, _, "\\2"}},
+                 re2:pipeline_new([{"(a)", "\\2"}])),
+    ?assertMatch({error, {missing_paren, _, _}},
+                 re2:pipeline_new([{"(a", "x"}])),
+    ?assertMatch({'EXIT', {badarg,_}},
+                 (catch re2:pipeline_new([{"a", "b", [unknown]}]))),
+    ?assertMatch({'EXIT', {badarg,_}}, (catch re2:pipeline_run("a", Lit))),
+    {ok, Empty} = re2:pipeline_new([{"x*", "-", [global]}]),
+    [?assertEqual(re2:replace(S, "x*", "-", [global]),
+                  re2:pipeline_run(S, Empty))
+     || S <- invalid_utf8()].
+
+%% Overlong forms, a value above U+10FFFF, a surrogate and a truncated
+%% sequence
+invalid_utf8() ->
+    [<<16#e0, 16#80, 16#80, "z">>, <<16#f0, 16#80, 16#80, 16#80, "z">>,
+     <<16#f4, 16#90, 16#80, 16#80, "z">>, <<16#ed, 16#a0, 16#80, "z">>,
+     <<16#c0, 16#80, "z">>, <<"z", 16#e2, 16#84>>].
+
+%% Plain string patterns are searched for without RE2, "(?:P)" is the same
+%% regex but always goes through RE2.
+literal_test() ->
+    Long = binary:copy(<<"aaaaaaaaaaaaaaab">>, 1024),
+    Subjects = ["", "ERROR", "an error and an ERROR", "a.b*c\\d\r\n",
+                <<"caf", 16#c3, 16#a9, " ", 16#e2, 16#84, 16#aa>>,
+                <<Long/binary, "ERROR.", Long/binary, "Error">>],
+    Patterns = ["ERROR", "error", "b", "\\\\", "a\\.b\\*", "\\r\\n",
+                "k", "aaab"],
+    Opts = [[], [caseless], [{offset, 3}], [{capture, first, index}],
+            [{capture, all_but_first, binary}], [{capture, none}],
+            [{capture, all_names, map}]],
+    [?assertEqual(re2:match(S, "(?:" ++ P ++ ")", O), re2:match(S, P, O))
+     || S <- Subjects, P <- Patterns, O <- Opts],
+    Rewrites = ["-", "<\\0>", "\\\\", "\\1", "\\x"],
+    [?assertEqual(re2:replace(S, "(?:" ++ P ++ ")", R, O),
+                  re2:replace(S, P, R, O))
+     || S <- Subjects, P <- Patterns, R <- Rewrites, O <- [[], [global]]],
+    {ok, Lit} = re2:compile("error", [caseless]),
+    {ok, RE} = re2:compile("(?:error)", [caseless]),
+    [?assertEqual(re2:match(S, RE), re2:match(S, Lit)) || S <- Subjects],
+    [?assertEqual(re2:replace(S, RE, "-", [global]),
+                  re2:replace(S, Lit, "-", [global])) || S <- Subjects].
+
+match_file_test() ->
+    case os:type() of
+        {win32, _} -> ok;  % no pread support
+        _ -> match_file_read()
+    end.
+
+match_file_read() ->
+    File = "re2_match_file_test.txt",
+    ok = file:write_file(File, <<"hello world\nfoo bar\nhello again\n">>),
+    try
+        ?assertEqual({match,[{0,5}]}, re2:match_file(File, "hel+o")),
+        ?assertEqual({match,[[{0,5},{1,3}],[{20,5},{21,3}]]},
+                     re2:match_file(File, "h(el+)o", [global])),
+        {ok, RE} = re2:compile("HELLO", [caseless]),
+        ?assertEqual({match,[[{0,5}],[{20,5}]]},
+                     re2:match_file(File, RE, [global, sequential,
+                                               {capture,first}])),
+        ?assertEqual({match,[{20,5}]},
+                     re2:match_file(File, RE, [{offset,3}])),
+        ?assertEqual({match,[[{20,5}]]},
+                     re2:match_file(File, "^hello", [global, {offset,20}])),
+        ?assertEqual(match,
+                     re2:match_file(File, RE, [{capture,none}])),
+        ?assertEqual(nomatch, re2:match_file(File, "zzz")),
+        ?assertMatch({'EXIT',{badarg,_}},
+                     (catch re2:match_file(File, "o",
+                                           [{capture,all,binary}]))),
+        ?assertEqual({match,[{16,3}]},
+                     re2:match_file(File, "bar$", [{offset,12}, {limit,19}])),
+        ?assertEqual({match,[{20,5},{-1,0}]},
+                     re2:match_file(File, "(x)?hello", [{offset,3}])),
+        ?assertEqual({error, enoent},
+                     re2:match_file("re2_no_such_file", "o")),
+        ?assertEqual({error, eisdir}, re2:match_file(".", "o")),
+        ?assertEqual({error, einval}, re2:match_file("/dev/null", "o")),
+        %% Concurrent scans each read into a buffer of their own
+        Self = self(),
+        Pids = [spawn_link(fun() ->
+                                   Self ! {self(), re2:match_file(File, "a")}
+                           end) || _ <- lists:seq(1, 100)],
+        [receive {Pid, R} -> ?assertEqual({match,[{17,1}]}, R) end
+         || Pid <- Pids]
+    after
+        file:delete(File)
+    end,
+    match_file_truncated().
+
+%% Truncate the file while it's read. Depending on timing the file is
+%% already empty when the read starts, but at least one of the tries
+%% should hit the read.
+match_file_truncated() ->
+    File = "re2_match_file_truncate.txt",
+    Data = binary:copy(<<"ab">>, 16 bsl 20),
+    try
+        Results = [begin
+                       ok = file:write_file(File, Data),
+                       spawn_link(fun() ->
+                                          timer:sleep(I rem 4),
+                                          ok = file:write_file(File, <<>>)
+                                  end),
+                       re2:match_file(File, "(a|b)*c")
+                   end || I <- lists:seq(1, 20)],
+        ?assertEqual([], [R || R <- Results,
+                               R =/= {error, file_changed}, R =/= nomatch]),
+        ?assert(lists:member({error, file_changed}, Results))
+    after
+        file:delete(File)
+    end.
+
+possible_match_range_test() ->
+    ?assertEqual({<<"abc">>, <<"abc">>}, re2:possible_match_range("^abc", 10)),
+    ?assertEqual({<<"ABC">>, <<"abc">>},
+                 re2:possible_match_range("^(?i)abc", 10)),
+    ?assertEqual(unbounded, re2:possible_match_range("^abc", 0)),
+    ?assertEqual({<<"abc">>, <<"abd">>},
+                 re2:possible_match_range("^abcdef(x|y)z", 3)),
+    {ok, RE} = re2:compile("^key/(foo|bar)/\\d+"),
+    Range = re2:possible_match_range("^key/(foo|bar)/\\d+", 10),
+    ?assertEqual({<<"key/bar/0">>, <<"key/foo/9:">>}, Range),
+    ?assertEqual(Range, re2:possible_match_range(RE, 10)),
+    ?assertEqual(Range, re2:possible_match_range(RE, 10)),
+    {Min, Max} = Range,
+    [?assert(Min =< Key andalso Key =< Max)
+     || Key <- [<<"key/bar/0">>, <<"key/foo/123">>, <<"key/foo/9">>]],
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:possible_match_range("(a", 3))),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:possible_match_range("a", -1))).
+
+warmup_test() ->
+    Samples = ["mail joe@example.com now", <<"x">>],
+    {ok, RE} = re2:compile("(\\w+)@(\\w+)\\.com",
+                           [{warmup, Samples}, {replicas, 2}]),
+    ?assertMatch(#{warmup_samples := 2, warmup_bytes := 25, replicas := 2,
+                   literal := false}, re2:stats(RE)),
+    ?assertEqual(ok, re2:warmup(RE, ["bob@host.com"])),
+    ?assertMatch(#{warmup_samples := 3, warmup_bytes := 37}, re2:stats(RE)),
+    ?assertEqual({match,[<<"bob@host.com">>,<<"bob">>,<<"host">>]},
+                 re2:match("a bob@host.com", RE)),
+    ?assertMatch(#{literal := true, warmup_samples := 0},
+                 re2:stats(element(2, re2:compile("ERROR")))),
+    {ok, Lazy} = re2:compile("h.*o", [{lazy, true}]),
+    ?assertEqual(ok, re2:warmup(Lazy, ["hello"])),
+    ?assertMatch([{ok, _}, {error, _}],
+                 re2:compile_many(["a+", "(b"], [{warmup, ["aaa"]}])),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile("a", [{warmup, [1000]}]))),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile("a", [{warmup, []}, {lazy, true}]))),
+    ?assertMatch({'EXIT',{badarg,_}}, (catch re2:warmup("a", []))),
+    ?assertMatch({'EXIT',{badarg,_}}, (catch re2:stats("a"))).
+
+auto_max_mem_test() ->
+    %% The DFA for this needs more states than 1 MB holds
+    Pattern = "(a|b)*a(a|b){12}c",
+    rand:seed(exsss, {1, 2, 3}),
+    Subject = << <<(lists:nth(rand:uniform(2), "ab"))>>
+                 || _ <- lists:seq(1, 200000) >>,
+    case catch re2:compile(Pattern, [{max_mem, 1 bsl 20},
+                                     {auto_max_mem, 16 bsl 20}]) of
+        {'EXIT',{badarg,_}} ->
+            %% RE2 without the DFA hooks
+            {ok, Plain} = re2:compile(Pattern),
+            ?assertMatch(#{dfa_failures := undefined}, re2:stats(Plain));
+        {ok, RE} ->
+            ?assertMatch(#{max_mem := 1048576}, re2:stats(RE)),
+            ?assertEqual(nomatch, re2:match(Subject, RE)),
+            ?assert(maps:get(dfa_failures, re2:stats(RE)) >= 1),
+            ?assert(wait_max_mem(RE, 1 bsl 20, 100) > 1 bsl 20),
+            ?assertEqual(nomatch, re2:match(Subject, RE)),
+            %% Doubling 0 gets nowhere, it starts from RE2's default
+            {ok, RE0} = re2:compile(Pattern, [{max_mem, 0},
+                                              {auto_max_mem, 16 bsl 20}]),
+            ?assertEqual(nomatch, re2:match(Subject, RE0)),
+            ?assert(wait_max_mem(RE0, 0, 100) >= 8 bsl 20)
+    end,
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:compile("a", [{auto_max_mem, 0}]))).
+
+wait_max_mem(RE, Old, 0) ->
+    maps:get(max_mem, re2:stats(RE), Old);
+wait_max_mem(RE, Old, N) ->
+    case re2:stats(RE) of
+        #{max_mem := Old} ->
+            timer:sleep(10),
+            wait_max_mem(RE, Old, N - 1);
+        #{max_mem := New} ->
+            New
+    end.
+
+slow_log_test() ->
+    ok = re2:set_slow_log_threshold(0),
+    {match, _} = re2:match("abc", "b", [{capture, first, index}]),
+    <<"a-c">> = re2:replace("abc", "b", "-", [global]),
+    ok = re2:set_slow_log_threshold(infinity),
+    [Replace, Match | _] = re2:slow_log(),
+    ?assertMatch(#{call := replace, global := true, pattern_prefix := <<"b">>,
+                   pattern_size := 1, subject_size := 3}, Replace),
+    ?assertMatch(#{call := match, capture := {first, index},
+                   pattern_prefix := <<"b">>, subject_size := 3}, Match),
+    ?assertEqual(maps:get(pattern_hash, Match),
+                 maps:get(pattern_hash, Replace)),
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:set_slow_log_threshold(-1))),
+    ok = re2:set_slow_log_threshold(10000).
+
+window_test() ->
+    Opts = fun(Window) -> Window ++ [{capture, all, index}] end,
+    {ok, RE} = re2:compile("a(b)c"),
+    {ok, Lit} = re2:compile("abc"),
+    S = "abc abc abc",
+    ?assertEqual({match,[{4,3},{5,1}]},
+                 re2:match(S, RE, Opts([{offset, 1}]))),
+    ?assertEqual(nomatch,
+                 re2:match(S, RE, Opts([{offset, 1}, {limit, 6}]))),
+    ?assertEqual({match,[{4,3},{5,1}]},
+                 re2:match(S, RE, Opts([{offset, 1}, {limit, 7}]))),
+    ?assertEqual({match,[{4,3}]},
+                 re2:match(S, Lit, Opts([{offset, 1}, {limit, 7}]))),
+    ?assertEqual(nomatch,
+                 re2:match(S, Lit, Opts([{offset, 1}, {anchor, start}]))),
+    ?assertEqual({match,[{4,3}]},
+                 re2:match(S, Lit, Opts([{offset, 4}, {anchor, start}]))),
+    ?assertEqual(nomatch,
+                 re2:match(S, RE, Opts([{offset, 4}, {anchor, both}]))),
+    ?assertEqual({match,[{4,3},{5,1}]},
+                 re2:match(S, RE, Opts([{offset, 4}, {limit, 7},
+                                        {anchor, both}]))),
+    ?assertEqual(nomatch, re2:match(S, RE, [{offset, 100}])),
+    %% Pattern anchors and \b see the window bounds, like a sub binary
+    ?assertEqual({match,[{4,3}]},
+                 re2:match("xxx abc", "^abc", Opts([{offset, 4}]))),
+    ?assertEqual({match,[{0,3}]},
+                 re2:match("abcd", "abc$", Opts([{limit, 3}]))),
+    ?assertEqual({match,[{0,3}]},
+                 re2:match("abcd", "abc\\b", Opts([{limit, 3}]))),
+    ?assertMatch({'EXIT', {badarg,_}},
+                 (catch re2:match(S, RE, [{offset, -1}]))),
+    ?assertMatch({'EXIT', {badarg,_}},
+                 (catch re2:match(S, RE, [{anchor, 'end'}]))).
+
 run_test() ->
     match_test(run).
 
@@ -46,8 +412,8 @@ match_test(FunName) ->
 
     ?assertEqual(match, re2:FunName("heLlo", ".*ello",
                                     [caseless,{capture,none}])),
-    ?assertMatch({'EXIT',{badarg,_}},
-                 (catch re2:FunName("Hello", RegExA, [caseless]))),
+    ?assertEqual({match,[<<"Hello">>]},
+                 re2:FunName("Hello", RegExA, [caseless])),
 
     ?assertEqual({match,[<<>>,<<>>,<<>>]},
                  re2:FunName(<<"hello">>, RegExA,
@@ -112,4 +478,38 @@ match_test(FunName) ->
 
     {ok, RegExD} = re2:compile(<<"h.*o">>),
 
-    ?assertEqual(nomatch, re2:FunName("Hello", RegExD)).
+    ?assertEqual(nomatch, re2:FunName("Hello", RegExD)),
+
+    {ok, RegExE} = re2:compile("(?P<y>\\d+)-(?P<m>\\d+)(-(?P<d>\\d+))?"),
+
+    ?assertEqual({match,#{<<"y">> => <<"2021">>, <<"m">> => <<"06">>,
+                          <<"d">> => <<>>}},
+                 re2:FunName("2021-06", RegExE, [{capture,all_names,map}])),
+
+    ?assertEqual({match,#{<<"y">> => <<"2021">>, <<"m">> => <<"06">>,
+                          <<"d">> => <<"30">>}},
+                 re2:FunName("2021-06-30", RegExE,
+                             [{capture,all_names,map}])),
+
+    ?assertEqual({match,[{8,2},{5,2},{0,4}]},
+                 re2:FunName("2021-06-30", RegExE,
+                             [{capture,all_names,index}])),
+
+    ?assertEqual({match,#{<<"a">> => <<"b">>}},
+                 re2:FunName("abc", "(?P<a>b)", [{capture,all_names,map}])),
+
+    ?assertMatch({'EXIT',{badarg,_}},
+                 (catch re2:FunName("abc", "(?P<a>b)", [{capture,all,map}]))),
+
+    Utf8 = <<"h\x{e9}llo w\x{f6}rld"/utf8>>,
+    ?assertEqual({match,[{7,4},{7,3},{10,1}]},
+                 re2:FunName(Utf8, <<"(w.)(r)"/utf8>>,
+                             [{capture,all,index}])),
+    ?assertEqual({match,[{6,3},{6,2},{8,1}]},
+                 re2:FunName(Utf8, <<"(w.)(r)"/utf8>>,
+                             [{capture,all,char_index}])),
+    ?assertEqual({match,[{2,3},{-1,0}]},
+                 re2:FunName(Utf8, "(x)?llo", [{capture,all,char_index}])),
+    ?assertEqual({match,[{1,1},{2,2}]},
+                 re2:FunName(Utf8, <<"(?P<a>\x{e9})(?P<b>l+)"/utf8>>,
+                             [{capture,all_names,char_index}])).